@@ -0,0 +1,473 @@
+#include <vector>
+#include <string>
+#include <map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <chrono>
+#include <atomic>
+#include <functional>
+#include <cstdlib>
+#include <cstring>
+#include <tclap/CmdLine.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "elfio/elfio.hpp"
+#include "common.hpp"
+#include "tools.hpp"
+#include "generate.hpp"
+
+#define VERSION "0.1"
+
+/* Every heap allocation in the process is counted, so that each case can
+ * report how many it made */
+static std::atomic<uint64_t> allocationCount(0);
+
+void *operator new(size_t size)
+{
+	allocationCount++;
+	void *p = malloc(size == 0 ? 1 : size);
+	if(p == nullptr)
+		throw std::bad_alloc();
+	return p;
+}
+
+void operator delete(void *p) noexcept
+{
+	free(p);
+}
+
+struct Args {
+	std::string output;
+	std::string baseline;
+	std::string filter;
+	std::string dir;
+	unsigned repeat;
+	bool quick;
+
+	static Args parse(int argc, char **argv){
+		Args args;
+
+		TCLAP::CmdLine cmdLine("saruman benchmarks", ' ', VERSION);
+		TCLAP::ValueArg<std::string> outputArg("o", "output", "Write the results to this file as JSON", false, "bench.json", "filename", cmdLine);
+		TCLAP::ValueArg<std::string> baselineArg("b", "baseline", "Compare with the results of an earlier run", false, "", "filename", cmdLine);
+		TCLAP::ValueArg<std::string> filterArg("f", "filter", "Only run the cases whose names contain this", false, "", "text", cmdLine);
+		TCLAP::ValueArg<std::string> dirArg("d", "dir", "Directory for the input files (default: a temporary one)", false, "", "directory", cmdLine);
+		TCLAP::ValueArg<unsigned> repeatArg("r", "repeat", "Run each case this many times and report the fastest", false, 3, "count", cmdLine);
+		TCLAP::SwitchArg quickArg("q", "quick", "Use smaller inputs", cmdLine);
+
+		cmdLine.parse(argc, argv);
+
+		args.output = outputArg.getValue();
+		args.baseline = baselineArg.getValue();
+		args.filter = filterArg.getValue();
+		args.dir = dirArg.getValue();
+		args.repeat = std::max(1u, repeatArg.getValue());
+		args.quick = quickArg.getValue();
+
+		return args;
+	}
+};
+
+/* The inputs come from objgen's generator: runs of equal sized sections, a
+ * loadable segment for every few of them, and a symbol table. */
+struct InputSpec {
+	const char *name;
+	unsigned sections;
+	ELFIO::Elf_Xword sectionSize;
+	unsigned sectionsPerSegment;
+	unsigned symbols;
+};
+
+static const InputSpec inputSpecs[] = {
+	{"small", 16, 64 * 1024, 4, 1000},
+	{"large", 64, 4 * 1024 * 1024, 8, 10000},
+	/* Mostly tables rather than data */
+	{"many", 60000, 256, 20, 200000},
+};
+
+static const unsigned OperationsPerCase = 10000;
+
+struct Input {
+	InputSpec spec;
+	std::string path;
+	std::string batchPath;  /* objinfo queries */
+	off_t size;
+};
+
+static bool buildInput(const Input &input)
+{
+	GenerateSpec spec;
+	spec.sections = input.spec.sections;
+	spec.segments = input.spec.sections / input.spec.sectionsPerSegment;
+	spec.segmentSize = input.spec.sectionSize * input.spec.sectionsPerSegment;
+	spec.symbols = input.spec.symbols;
+
+	ELFIO::elfio elf;
+	generateElf(spec, elf);
+	if(!elf.save(input.path))
+		return false;
+
+	std::ofstream batch(input.batchPath);
+	for(unsigned i = 0; i < OperationsPerCase; i++)
+		batch << "sym " << generatedSymbolName((i * 7919) % spec.symbols) << "\n";
+
+	return batch.good();
+}
+
+/* Addresses spread over all of the sections with data */
+static std::vector<ELFIO::Elf64_Addr> patchAddresses(ELFIO::elfio &elf)
+{
+	std::vector<const ELFIO::section *> sections;
+	for(auto section: elf.sections) {
+		if(section->get_type() == SHT_PROGBITS && section->get_size() != 0)
+			sections.push_back(section);
+	}
+
+	std::vector<ELFIO::Elf64_Addr> addresses;
+	for(unsigned i = 0; !sections.empty() && i < OperationsPerCase; i++) {
+		const ELFIO::section *section = sections[(i * 7919) % sections.size()];
+		addresses.push_back(section->get_address() + (i * 104729) % section->get_size());
+	}
+	return addresses;
+}
+
+struct Result {
+	bool ok;
+	double seconds;        /* the fastest run */
+	uint64_t bytes;        /* per run */
+	uint64_t operations;   /* per run */
+	uint64_t allocations;  /* in the fastest run */
+	long peakRssKb;
+};
+
+/* Run 'body' args.repeat times, after an untimed 'setup' each time. */
+static void measure(Result &result, const Args &args, std::function<void()> setup, std::function<void()> body)
+{
+	for(unsigned i = 0; i < args.repeat; i++) {
+		setup();
+
+		uint64_t allocationsBefore = allocationCount;
+		auto start = std::chrono::steady_clock::now();
+		body();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+		if(i == 0 || elapsed.count() < result.seconds) {
+			result.seconds = elapsed.count();
+			result.allocations = allocationCount - allocationsBefore;
+		}
+	}
+}
+
+/* Call a tool as saruman would, with its output going to /dev/null */
+static int runTool(int (*toolMain)(int, char **, Pipe &), std::vector<std::string> argv)
+{
+	std::vector<char *> toolArgv;
+	for(auto &arg: argv)
+		toolArgv.push_back(&arg[0]);
+	toolArgv.push_back(nullptr);
+
+	TCLAP::OptionalUnlabeledTracker::alreadyOptional() = false;
+	Pipe pipe;
+	return toolMain(toolArgv.size() - 1, toolArgv.data(), pipe);
+}
+
+static std::unique_ptr<ELFIO::elfio> loadCopy(const Input &input)
+{
+	ELFIO::elfio loaded;
+	if(!loaded.load(input.path))
+		return nullptr;
+
+	std::unique_ptr<ELFIO::elfio> copy(new ELFIO::elfio(newFromTemplate(loaded)));
+	copyElfData(*copy, loaded);
+	return copy;
+}
+
+struct Case {
+	const char *name;
+	std::function<void(Result &, const Input &, const Args &)> run;
+};
+
+static const Case cases[] = {
+	{"load", [](Result &result, const Input &input, const Args &args) {
+		measure(result, args, []() { }, [&]() {
+			ELFIO::elfio elf;
+			result.ok = elf.load(input.path);
+		});
+		result.bytes = input.size;
+	}},
+
+	{"layout", [](Result &result, const Input &input, const Args &args) {
+		std::unique_ptr<ELFIO::elfio> elf;
+		measure(result, args, [&]() { elf = loadCopy(input); }, [&]() {
+			result.ok = elf && elf->layout();
+		});
+		result.operations = input.spec.sections;
+	}},
+
+	{"save", [](Result &result, const Input &input, const Args &args) {
+		std::unique_ptr<ELFIO::elfio> elf;
+		measure(result, args, [&]() { elf = loadCopy(input); }, [&]() {
+			auto image = elf ? elf->save_image() : nullptr;
+			result.ok = image != nullptr;
+			result.bytes = image ? image->get_size() : 0;
+		});
+	}},
+
+	/* As objpatch does it: find the section, then write to its data */
+	{"patch", [](Result &result, const Input &input, const Args &args) {
+		std::unique_ptr<ELFIO::elfio> elf;
+		std::vector<ELFIO::Elf64_Addr> addresses;
+		measure(result, args, [&]() {
+			elf = loadCopy(input);
+			if(elf)
+				addresses = patchAddresses(*elf);
+		}, [&]() {
+			result.ok = elf != nullptr && addresses.size() == OperationsPerCase;
+			for(unsigned i = 0; result.ok && i < OperationsPerCase; i++) {
+				ELFIO::Elf64_Addr vaddr = addresses[i];
+				ELFIO::section *section = elf->sections.find_by_address(vaddr, SHT_PROGBITS);
+				char *data = section ? section->get_mutable_data() : nullptr;
+				if(data != nullptr)
+					data[vaddr - section->get_address()] = i;
+				result.ok = data != nullptr;
+			}
+		});
+		result.operations = OperationsPerCase;
+	}},
+
+	{"lookup", [](Result &result, const Input &input, const Args &args) {
+		ELFIO::elfio elf;
+		elf.load(input.path);
+		ELFIO::section *symtab = elf.sections[".symtab"];
+		measure(result, args, []() { }, [&]() {
+			result.ok = symtab != nullptr;
+			if(!result.ok)
+				return;
+
+			/* Includes building the lookup table */
+			ELFIO::symbol_section_accessor symbols(elf, symtab);
+			for(unsigned i = 0; result.ok && i < OperationsPerCase; i++) {
+				ELFIO::Elf64_Addr value;
+				ELFIO::Elf_Xword size;
+				unsigned char bind, type, other;
+				ELFIO::Elf_Half sectionIndex;
+				result.ok = symbols.get_symbol(generatedSymbolName((i * 7919) % input.spec.symbols),
+					value, size, bind, type, sectionIndex, other);
+			}
+		});
+		result.operations = OperationsPerCase;
+	}},
+
+	/* The tools, end to end */
+	{"objcat", [](Result &result, const Input &input, const Args &args) {
+		measure(result, args, []() { }, [&]() {
+			result.ok = runTool(objcatMain, {"objcat", input.path}) == 0;
+		});
+		result.bytes = input.size;
+	}},
+
+	{"objpatch", [](Result &result, const Input &input, const Args &args) {
+		/* The start of the first section */
+		std::stringstream patch;
+		patch << "0x" << std::hex << GenerateSpec().base << "=u32:1";
+		measure(result, args, []() { }, [&]() {
+			result.ok = runTool(objpatchMain, {"objpatch", "-V", patch.str(), input.path}) == 0;
+		});
+		result.bytes = input.size;
+	}},
+
+	{"objinfo", [](Result &result, const Input &input, const Args &args) {
+		measure(result, args, []() { }, [&]() {
+			result.ok = runTool(objinfoMain, {"objinfo", "-b", input.batchPath, input.path}) == 0;
+		});
+		result.operations = OperationsPerCase;
+	}},
+};
+
+/* Run 'work' in a child process, so that each case starts from a clean heap
+ * and has its own peak RSS. The child's stdout goes to /dev/null. */
+static Result runInChild(std::function<void(Result &)> work)
+{
+	Result result = Result();
+	int fds[2];
+	if(pipe(fds) != 0)
+		return result;
+
+	pid_t pid = fork();
+	if(pid == 0) {
+		close(fds[0]);
+		int devNull = open("/dev/null", O_WRONLY);
+		if(devNull >= 0)
+			dup2(devNull, STDOUT_FILENO);
+
+		try {
+			work(result);
+		} catch (std::exception &e) {
+			std::cerr << "error: " << e.what() << "\n";
+			result.ok = false;
+		}
+
+		struct rusage usage;
+		if(getrusage(RUSAGE_SELF, &usage) == 0)
+			result.peakRssKb = usage.ru_maxrss;
+
+		_exit(writeAll(fds[1], (const char *)&result, sizeof result) ? 0 : 1);
+	}
+
+	close(fds[1]);
+	Result childResult;
+	ssize_t got = pid < 0 ? -1 : read(fds[0], &childResult, sizeof childResult);
+	close(fds[0]);
+	if(pid > 0)
+		waitpid(pid, nullptr, 0);
+
+	return got == sizeof childResult ? childResult : result;
+}
+
+/* Reads back the "name" and "seconds" of each case from a results file */
+static std::map<std::string, double> readBaseline(const std::string &filename)
+{
+	std::map<std::string, double> seconds;
+	std::ifstream file(filename);
+	std::string line;
+
+	while(std::getline(file, line)) {
+		size_t name = line.find("\"name\": \"");
+		size_t time = line.find("\"seconds\": ");
+		if(name == std::string::npos || time == std::string::npos)
+			continue;
+
+		name += strlen("\"name\": \"");
+		seconds[line.substr(name, line.find('"', name) - name)] = std::stod(line.substr(time + strlen("\"seconds\": ")));
+	}
+
+	return seconds;
+}
+
+static double perSecond(uint64_t count, double seconds)
+{
+	return seconds > 0 ? count / seconds : 0;
+}
+
+int main(int argc, char **argv)
+{
+	try {
+		Args args = Args::parse(argc, argv);
+
+		std::map<std::string, double> baseline;
+		if(args.baseline != "") {
+			baseline = readBaseline(args.baseline);
+			if(baseline.empty()) {
+				std::cerr << "error: no results in " << args.baseline << "\n";
+				return 1;
+			}
+		}
+
+		bool tempDir = args.dir == "";
+		if(tempDir) {
+			const char *tmp = getenv("TMPDIR");
+			std::string pattern = std::string(tmp ? tmp : "/tmp") + "/saruman-bench.XXXXXX";
+			if(mkdtemp(&pattern[0]) == nullptr) {
+				std::cerr << "error: couldn't create a temporary directory\n";
+				return 1;
+			}
+			args.dir = pattern;
+		}
+
+		std::vector<Input> inputs;
+		for(auto &spec: inputSpecs) {
+			Input input;
+			input.spec = spec;
+			if(args.quick) {
+				input.spec.sections = std::min(input.spec.sections, 6000u);
+				input.spec.sectionSize = std::min<ELFIO::Elf_Xword>(input.spec.sectionSize, 256 * 1024);
+				input.spec.symbols = std::min(input.spec.symbols, 20000u);
+			}
+			input.path = args.dir + "/" + spec.name + ".elf";
+			input.batchPath = args.dir + "/" + spec.name + ".queries";
+
+			Result built = runInChild([&](Result &result) { result.ok = buildInput(input); });
+			struct stat st;
+			if(!built.ok || stat(input.path.c_str(), &st) != 0) {
+				std::cerr << "error: couldn't build input " << input.path << "\n";
+				return 1;
+			}
+			input.size = st.st_size;
+			inputs.push_back(input);
+		}
+
+		std::ofstream json(args.output);
+		json << "{\n  \"cases\": [\n";
+
+		std::cout << std::left << std::setw(18) << "case" << std::right
+			<< std::setw(12) << "seconds" << std::setw(10) << "MB/s"
+			<< std::setw(12) << "ops/s" << std::setw(12) << "allocs"
+			<< std::setw(12) << "peak KB";
+		if(!baseline.empty())
+			std::cout << std::setw(12) << "vs base";
+		std::cout << "\n";
+
+		bool good = true, first = true;
+		for(auto &input: inputs) {
+			for(auto &benchCase: cases) {
+				std::string name = std::string(benchCase.name) + "/" + input.spec.name;
+				if(name.find(args.filter) == std::string::npos)
+					continue;
+
+				Result result = runInChild([&](Result &result) { benchCase.run(result, input, args); });
+				good = good && result.ok;
+
+				double mbPerSecond = perSecond(result.bytes, result.seconds) / (1024 * 1024);
+				double opsPerSecond = perSecond(result.operations, result.seconds);
+
+				std::cout << std::left << std::setw(18) << name << std::right << std::fixed
+					<< std::setw(12) << std::setprecision(6) << result.seconds
+					<< std::setw(10) << std::setprecision(1) << mbPerSecond
+					<< std::setw(12) << std::setprecision(0) << opsPerSecond
+					<< std::setw(12) << result.allocations
+					<< std::setw(12) << result.peakRssKb;
+				if(baseline.count(name) && baseline[name] > 0)
+					std::cout << std::setw(11) << std::setprecision(2) << result.seconds / baseline[name] << "x";
+				if(!result.ok)
+					std::cout << "  FAILED";
+				std::cout << std::endl;
+
+				json << (first ? "" : ",\n") << std::fixed
+					<< "    {\"name\": \"" << name << "\", "
+					<< "\"ok\": " << (result.ok ? "true" : "false") << ", "
+					<< "\"seconds\": " << std::setprecision(9) << result.seconds << ", "
+					<< "\"mb_per_s\": " << std::setprecision(3) << mbPerSecond << ", "
+					<< "\"ops_per_s\": " << std::setprecision(3) << opsPerSecond << ", "
+					<< "\"allocations\": " << result.allocations << ", "
+					<< "\"peak_rss_kb\": " << result.peakRssKb << "}";
+				first = false;
+			}
+		}
+
+		json << "\n  ]\n}\n";
+		json.close();
+		if(!json) {
+			std::cerr << "error: couldn't write " << args.output << "\n";
+			good = false;
+		}
+
+		if(tempDir) {
+			for(auto &input: inputs) {
+				unlink(input.path.c_str());
+				unlink(input.batchPath.c_str());
+			}
+			rmdir(args.dir.c_str());
+		}
+
+		return good ? 0 : 1;
+	} catch (TCLAP::ArgException &e) {
+		std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+		return 1;
+	}
+}
@@ -1,6 +1,19 @@
 #include <cassert>
+#include <cstring>
+#include <cerrno>
+#include <atomic>
+#include <thread>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
 
 #include "common.hpp"
+#include "tools.hpp"
 
 void copyElfData(ELFIO::elfio &dest, ELFIO::elfio &src)
 {
@@ -41,35 +54,672 @@ ELFIO::elfio newFromTemplate(ELFIO::elfio &templ, ELFIO::Elf64_Addr orEntry)
 	return elf;
 }
 
-ELFIO::elfio loadElf(const std::string &input)
+/* LZ4 block format. Each sequence is a token byte, whose high nibble is the
+ * literal count and low nibble the match length less 4 (15 in either means
+ * more length bytes follow, each added on, until one is below 255), then
+ * the literals, then a 16-bit little-endian offset back to the match, then
+ * the extra match length bytes. The final sequence is literals only, and
+ * decoders rely on the last 5 bytes being literals and on the last match
+ * starting at least 12 bytes before the end. */
+static const size_t LzMinMatch = 4;
+static const size_t LzLastLiterals = 5;
+static const size_t LzMatchLimit = 12;
+static const size_t LzMaxOffset = 65535;
+static const int LzHashBits = 16;
+
+static uint32_t lzRead32(const char *p)
+{
+	uint32_t value;
+	memcpy(&value, p, sizeof value);
+	return value;
+}
+
+static uint32_t lzHash(uint32_t sequence)
+{
+	return (sequence * 2654435761u) >> (32 - LzHashBits);
+}
+
+static void lzPutLength(std::vector<char> &out, size_t length)
+{
+	for(; length >= 255; length -= 255)
+		out.push_back((char)255);
+	out.push_back((char)length);
+}
+
+static void lzPutLiterals(std::vector<char> &out, const char *literals, size_t count, unsigned matchNybble)
+{
+	out.push_back((char)((std::min<size_t>(count, 15) << 4) | matchNybble));
+	if(count >= 15)
+		lzPutLength(out, count - 15);
+	out.insert(out.end(), literals, literals + count);
+}
+
+std::vector<char> compressLz(const char *src, size_t length)
+{
+	std::vector<char> out;
+	out.reserve(length / 2 + 16);
+
+	size_t anchor = 0;
+	if(length > LzMatchLimit) {
+		const size_t noMatch = ~(size_t)0;
+		std::vector<size_t> table((size_t)1 << LzHashBits, noMatch);
+		size_t limit = length - LzMatchLimit;
+		size_t matchEnd = length - LzLastLiterals;
+
+		for(size_t pos = 0; pos < limit; ) {
+			uint32_t sequence = lzRead32(src + pos);
+			uint32_t hash = lzHash(sequence);
+			size_t candidate = table[hash];
+			table[hash] = pos;
+
+			if(candidate == noMatch || pos - candidate > LzMaxOffset || lzRead32(src + candidate) != sequence) {
+				/* Step faster the longer nothing has matched, so data which
+				 * doesn't compress goes through quickly */
+				pos += 1 + ((pos - anchor) >> 6);
+				continue;
+			}
+
+			size_t matchLength = LzMinMatch;
+			while(pos + matchLength < matchEnd && src[candidate + matchLength] == src[pos + matchLength])
+				matchLength++;
+
+			size_t extra = matchLength - LzMinMatch;
+			lzPutLiterals(out, src + anchor, pos - anchor, std::min<size_t>(extra, 15));
+			size_t offset = pos - candidate;
+			out.push_back((char)(offset & 0xff));
+			out.push_back((char)(offset >> 8));
+			if(extra >= 15)
+				lzPutLength(out, extra - 15);
+
+			pos += matchLength;
+			anchor = pos;
+		}
+	}
+
+	lzPutLiterals(out, src + anchor, length - anchor, 0);
+	return out;
+}
+
+static bool lzGetLength(const unsigned char *&in, const unsigned char *end, size_t &length)
+{
+	unsigned char byte;
+	do {
+		if(in == end)
+			return false;
+		byte = *in++;
+		length += byte;
+	} while(byte == 255);
+
+	return true;
+}
+
+/* Decompress exactly destLength bytes. Corrupt input is reported rather than
+ * read or written out of bounds. */
+bool decompressLz(const char *src, size_t srcLength, char *dest, size_t destLength)
+{
+	const unsigned char *in = (const unsigned char *)src;
+	const unsigned char *end = in + srcLength;
+	size_t out = 0;
+
+	while(in < end) {
+		unsigned token = *in++;
+
+		size_t literals = token >> 4;
+		if(literals == 15 && !lzGetLength(in, end, literals))
+			return false;
+		if(literals > (size_t)(end - in) || literals > destLength - out)
+			return false;
+		memcpy(dest + out, in, literals);
+		in += literals;
+		out += literals;
+
+		if(in == end)
+			break;
+
+		if(end - in < 2)
+			return false;
+		size_t offset = in[0] | (in[1] << 8);
+		in += 2;
+		if(offset == 0 || offset > out)
+			return false;
+
+		size_t matchLength = token & 15;
+		if(matchLength == 15 && !lzGetLength(in, end, matchLength))
+			return false;
+		matchLength += LzMinMatch;
+		if(matchLength > destLength - out)
+			return false;
+
+		if(offset >= matchLength) {
+			memcpy(dest + out, dest + out - offset, matchLength);
+			out += matchLength;
+		} else {
+			/* The match overlaps the bytes it produces */
+			for(size_t i = 0; i < matchLength; i++, out++)
+				dest[out] = dest[out - offset];
+		}
+	}
+
+	return out == destLength;
+}
+
+/* The note descriptor, in the file's byte order: a version and an entry
+ * count (32 bits each), then per compressed segment its program header
+ * index and codec (32 bits each) and its decompressed and compressed file
+ * sizes (64 bits each). */
+static const char *CompressionNoteName = "saruman";
+static const uint32_t CompressionNoteVersion = 1;
+static const size_t CompressionNoteHeaderSize = 8;
+static const size_t CompressionNoteEntrySize = 24;
+
+template<typename T> static void putField(std::vector<char> &out, const ELFIO::endianess_convertor &convertor, T value)
+{
+	value = convertor(value);
+	out.insert(out.end(), (const char *)&value, (const char *)&value + sizeof value);
+}
+
+template<typename T> static T getField(const char *&in, const ELFIO::endianess_convertor &convertor)
+{
+	T value;
+	memcpy(&value, in, sizeof value);
+	in += sizeof value;
+	return convertor(value);
+}
+
+void addCompressionNote(ELFIO::elfio &elf, const std::vector<CompressedSegment> &segments)
+{
+	const ELFIO::endianess_convertor &convertor = elf.get_convertor();
+
+	std::vector<char> desc;
+	putField<uint32_t>(desc, convertor, CompressionNoteVersion);
+	putField<uint32_t>(desc, convertor, segments.size());
+	for(auto &segment: segments) {
+		putField<uint32_t>(desc, convertor, segment.segmentIndex);
+		putField<uint32_t>(desc, convertor, segment.codec);
+		putField<uint64_t>(desc, convertor, segment.fileSize);
+		putField<uint64_t>(desc, convertor, segment.compressedSize);
+	}
+
+	auto noteSection = elf.sections.add(".note.saruman");
+	noteSection->set_type(SHT_NOTE);
+	noteSection->set_addr_align(4);
+	ELFIO::note_section_accessor notes(elf, noteSection);
+	notes.add_note(NoteCompressedSegments, CompressionNoteName, desc.data(), desc.size());
+
+	auto noteSegment = elf.segments.add();
+	noteSegment->set_type(PT_NOTE);
+	noteSegment->set_flags(PF_R);
+	noteSegment->set_align(4);
+	noteSegment->add_section_index(noteSection->get_index(), noteSection->get_addr_align());
+}
+
+/* Look through the PT_NOTE segments rather than the sections, as the section
+ * table may have been left out. */
+bool findCompressionNote(ELFIO::elfio &elf, std::vector<CompressedSegment> &segments)
+{
+	const ELFIO::endianess_convertor &convertor = elf.get_convertor();
+
+	for(auto noteSegment: elf.segments) {
+		if(noteSegment->get_type() != PT_NOTE)
+			continue;
+
+		const char *data = noteSegment->get_data();
+		ELFIO::Elf_Xword size = data == nullptr ? 0 : noteSegment->get_file_size();
+		if(data == nullptr && noteSegment->get_sections_num() > 0 && elf.sections.size() > 0) {
+			/* An image built in memory keeps its data in its sections */
+			auto noteSection = elf.sections[noteSegment->get_section_index_at(0)];
+			data = noteSection->get_data();
+			size = data == nullptr ? 0 : noteSection->get_size();
+		}
+		ELFIO::Elf_Xword pos = 0;
+		while(size - pos >= 12) {
+			const char *header = data + pos;
+			uint32_t nameSize = getField<uint32_t>(header, convertor);
+			uint32_t descSize = getField<uint32_t>(header, convertor);
+			uint32_t type = getField<uint32_t>(header, convertor);
+			ELFIO::Elf_Xword namePadded = ((ELFIO::Elf_Xword)nameSize + 3) & ~(ELFIO::Elf_Xword)3;
+			ELFIO::Elf_Xword descPadded = ((ELFIO::Elf_Xword)descSize + 3) & ~(ELFIO::Elf_Xword)3;
+			if(namePadded + descPadded > size - pos - 12)
+				break;
+
+			const char *name = header;
+			const char *desc = name + namePadded;
+			pos += 12 + namePadded + descPadded;
+
+			if(type != NoteCompressedSegments || nameSize != strlen(CompressionNoteName) + 1
+					|| memcmp(name, CompressionNoteName, nameSize) != 0)
+				continue;
+
+			if(descSize < CompressionNoteHeaderSize
+					|| getField<uint32_t>(desc, convertor) != CompressionNoteVersion)
+				throw LoadError("Unsupported compressed image in " + elf.get_name());
+			uint32_t count = getField<uint32_t>(desc, convertor);
+			if(count > (descSize - CompressionNoteHeaderSize) / CompressionNoteEntrySize)
+				throw LoadError("Corrupt compressed segment table in " + elf.get_name());
+
+			segments.clear();
+			for(uint32_t i = 0; i < count; i++) {
+				CompressedSegment segment;
+				segment.segmentIndex = getField<uint32_t>(desc, convertor);
+				segment.codec = getField<uint32_t>(desc, convertor);
+				segment.fileSize = getField<uint64_t>(desc, convertor);
+				segment.compressedSize = getField<uint64_t>(desc, convertor);
+				segments.push_back(segment);
+			}
+			return true;
+		}
+	}
+
+	return false;
+}
+
+/* If elf is a compressed image, replace it with the uncompressed one: a
+ * section per loadable segment holding its decompressed data. Other segments
+ * and sections, the note included, are dropped. The new file is assembled in
+ * memory and loaded like any other, so its segments have their sizes and
+ * data. 'compressed' gets the segments that were compressed, by their index
+ * in the new image, for recompressElf. */
+bool decompressElf(ELFIO::elfio &elf, std::vector<CompressedSegment> &compressed)
+{
+	std::vector<CompressedSegment> table;
+	compressed.clear();
+	if(!findCompressionNote(elf, table))
+		return false;
+
+	std::vector<const CompressedSegment *> compressedBySegment(elf.segments.size(), nullptr);
+	for(auto &entry: table) {
+		if(entry.segmentIndex >= compressedBySegment.size() || entry.codec != CompressionCodecLz4)
+			throw LoadError("Corrupt compressed segment table in " + elf.get_name());
+		compressedBySegment[entry.segmentIndex] = &entry;
+	}
+
+	ELFIO::elfio original(std::move(elf));
+	ELFIO::elfio decompressed = newFromTemplate(original);
+
+	for(auto segment: original.segments) {
+		if(segment->get_type() != PT_LOAD || segment->get_memory_size() == 0)
+			continue;
+
+		std::string name;
+		if(segment->get_sections_num() > 0 && original.sections.size() > 0)
+			name = original.sections[segment->get_section_index_at(0)]->get_name();
+		else
+			name = ".seg" + std::to_string(segment->get_index());
+
+		auto section = decompressed.sections.add(name);
+		const char *data = segment->get_data();
+		ELFIO::Elf_Xword fileSize = segment->get_file_size();
+		const CompressedSegment *entry = compressedBySegment[segment->get_index()];
+
+		if(entry != nullptr) {
+			if(entry->compressedSize > fileSize || entry->fileSize > segment->get_memory_size())
+				throw LoadError("Corrupt compressed segment table in " + original.get_name());
+
+			std::vector<char> decompressed(entry->fileSize);
+			if(!decompressLz(data, entry->compressedSize, decompressed.data(), decompressed.size()))
+				throw LoadError("Corrupt compressed segment in " + original.get_name());
+			section->set_data(decompressed.data(), decompressed.size());
+			fileSize = entry->fileSize;
+		} else if(fileSize != 0) {
+			section->set_data(data, fileSize);
+		}
+
+		ELFIO::Elf_Xword flags = SHF_ALLOC;
+		if(segment->get_flags() & PF_X)
+			flags |= SHF_EXECINSTR;
+		if(segment->get_flags() & PF_W)
+			flags |= SHF_WRITE;
+
+		section->set_type(fileSize == 0 ? SHT_NOBITS : SHT_PROGBITS);
+		section->set_flags(flags);
+		section->set_addr_align(4);
+		section->set_size(segment->get_memory_size());
+		section->set_address(segment->get_virtual_address());
+
+		auto newSegment = decompressed.segments.add();
+		newSegment->set_type(PT_LOAD);
+		newSegment->set_flags(segment->get_flags());
+		newSegment->set_align(segment->get_align());
+		newSegment->set_virtual_address(segment->get_virtual_address());
+		newSegment->set_physical_address(segment->get_physical_address());
+		newSegment->add_section_index(section->get_index(), section->get_addr_align());
+
+		if(entry != nullptr) {
+			compressed.push_back(*entry);
+			compressed.back().segmentIndex = newSegment->get_index();
+		}
+	}
+
+	auto image = decompressed.save_image();
+	if(!image || !elf.load(image))
+		throw LoadError("Failed to decompress " + original.get_name());
+	elf.set_name(original.get_name());
+
+	return true;
+}
+
+bool decompressElf(ELFIO::elfio &elf)
+{
+	std::vector<CompressedSegment> compressed;
+	return decompressElf(elf, compressed);
+}
+
+/* The reverse of decompressElf, for a tool that changed a decompressed image
+ * and writes it out again: the segments that were compressed are compressed
+ * again, as objcat -z would, and listed in a new note. One whose data no
+ * longer shrinks is stored as it is. */
+void recompressElf(ELFIO::elfio &elf, const std::vector<CompressedSegment> &compressed)
+{
+	std::vector<CompressedSegment> table;
+
+	for(auto &entry: compressed) {
+		auto segment = elf.segments[entry.segmentIndex];
+		auto section = elf.sections[segment->get_section_index_at(0)];
+		ELFIO::Elf_Xword memorySize = section->get_size();
+
+		std::vector<char> data = compressLz(section->get_data(), entry.fileSize);
+		if(data.size() == 0 || data.size() >= entry.fileSize)
+			continue;
+
+		section->set_data(data.data(), data.size());
+		if(memorySize > data.size()) {
+			auto padSection = elf.sections.add(section->get_name() + ".z");
+			padSection->set_type(SHT_NOBITS);
+			padSection->set_flags(section->get_flags());
+			padSection->set_addr_align(1);
+			padSection->set_size(memorySize - data.size());
+			padSection->set_address(section->get_address() + data.size());
+			segment->add_section_index(padSection->get_index(), padSection->get_addr_align());
+		}
+
+		table.push_back(entry);
+		table.back().compressedSize = data.size();
+	}
+
+	if(!table.empty())
+		addCompressionNote(elf, table);
+}
+
+static void loadElfInto(ELFIO::elfio &elf, const std::string &input)
 {
-	ELFIO::elfio elf;
 	bool loaded;
 
 	if(input == "-")
-		loaded = elf.load_nonseekable(std::cin);
+		loaded = elf.load_fd(STDIN_FILENO, true);
 	else
-		loaded = elf.load(input);
+		loaded = elf.load_lazy(input);
 
 	if(!loaded) {
 		throw LoadError("Failed to load " + input);
 	}
 
-	return elf;
+	decompressElf(elf);
 }
 
-std::vector<ELFIO::elfio> loadElves(std::vector<std::string> &filenames) {
-	std::vector<ELFIO::elfio> elves;
+ELFIO::elfio loadElf(const std::string &input)
+{
+	ELFIO::elfio elf;
 
+	loadElfInto(elf, input);
+
+	return elf;
+}
+
+/* Load inputs on up to 'jobs' threads (0: one per CPU). The result is in
+ * command-line order, and if several inputs fail to load the error reported
+ * is the one for the first of them, however the loads were scheduled. */
+std::vector<ELFIO::elfio> loadElves(std::vector<std::string> &filenames, unsigned jobs) {
 	if(filenames.size() == 0) {
 		/* We want at least one input, so read from stdin. */
+		std::vector<ELFIO::elfio> elves;
 		elves.push_back(std::move(loadElf("-")));
-	} else {
-		for(auto filename: filenames) {
-			elves.push_back(std::move(loadElf(filename)));
+		return elves;
+	}
+
+	std::vector<ELFIO::elfio> elves(filenames.size());
+	std::vector<std::exception_ptr> errors(filenames.size());
+	std::atomic<size_t> nextInput(0);
+
+	auto worker = [&]() {
+		for(size_t i = nextInput++; i < filenames.size(); i = nextInput++) {
+			try {
+				loadElfInto(elves[i], filenames[i]);
+			} catch (...) {
+				errors[i] = std::current_exception();
+			}
 		}
+	};
+
+	if(jobs == 0)
+		jobs = std::max(1u, std::thread::hardware_concurrency());
+	jobs = std::min<size_t>(jobs, filenames.size());
+
+	std::vector<std::thread> threads;
+	for(unsigned i = 1; i < jobs; i++)
+		threads.push_back(std::thread(worker));
+	worker();
+	for(auto &thread: threads)
+		thread.join();
+
+	for(auto &error: errors) {
+		if(error)
+			std::rethrow_exception(error);
 	}
 
 	return elves;
 }
 
+
+bool writeAll(int fd, const char *bytes, size_t length)
+{
+	while(length > 0) {
+		ssize_t done = write(fd, bytes, length);
+		if(done < 0 && errno == EINTR)
+			continue;
+		if(done <= 0)
+			return false;
+
+		bytes += done;
+		length -= done;
+		ELFIO::stats::count(ELFIO::stats::get().bytes_written, done);
+	}
+
+	return true;
+}
+
+/* Copy length bytes starting at offset in inFd to the current position of
+ * outFd. Where the kernel can do the copy itself (file to file, or file to
+ * pipe) the data never comes up to user space. */
+static bool copyFdData(int inFd, off_t offset, int outFd, size_t length)
+{
+#ifdef __linux__
+	while(length > 0) {
+		ssize_t done = copy_file_range(inFd, &offset, outFd, nullptr, length, 0);
+		if(done < 0 && errno == EINTR)
+			continue;
+		if(done <= 0)
+			break;
+
+		length -= done;
+		ELFIO::stats::count(ELFIO::stats::get().bytes_read, done);
+		ELFIO::stats::count(ELFIO::stats::get().bytes_written, done);
+	}
+
+	while(length > 0) {
+		ssize_t done = splice(inFd, &offset, outFd, nullptr, length, SPLICE_F_MORE);
+		if(done < 0 && errno == EINTR)
+			continue;
+		if(done <= 0)
+			break;
+
+		length -= done;
+		ELFIO::stats::count(ELFIO::stats::get().bytes_read, done);
+		ELFIO::stats::count(ELFIO::stats::get().bytes_written, done);
+	}
+#endif
+
+	std::vector<char> buf(std::min(length, (size_t)1024 * 1024));
+	while(length > 0) {
+		ssize_t got = pread(inFd, buf.data(), std::min(length, buf.size()), offset);
+		if(got < 0 && errno == EINTR)
+			continue;
+		if(got > 0)
+			ELFIO::stats::count(ELFIO::stats::get().bytes_read, got);
+		if(got <= 0 || !writeAll(outFd, buf.data(), got))
+			return false;
+
+		offset += got;
+		length -= got;
+	}
+
+	return true;
+}
+
+/* As copyFdData, but holes in a sparse input file are kept as holes when the
+ * output is a regular file too. */
+bool copyFdRange(int inFd, off_t offset, int outFd, size_t length)
+{
+	struct stat inStat, outStat;
+	bool sparse = fstat(inFd, &inStat) == 0 && fstat(outFd, &outStat) == 0
+		&& S_ISREG(inStat.st_mode) && S_ISREG(outStat.st_mode)
+		&& inStat.st_blocks * 512 < inStat.st_size;
+
+#ifdef SEEK_HOLE
+	off_t end = offset + length;
+	while(sparse && offset < end) {
+		off_t data = lseek(inFd, offset, SEEK_DATA);
+		if(data < 0 || data > end)
+			data = end;
+
+		if(data > offset) {
+			off_t outPosition = lseek(outFd, data - offset, SEEK_CUR);
+			if(outPosition < 0)
+				return false;
+			/* A hole at the end only exists if the file is extended over it */
+			if(outPosition > outStat.st_size && ftruncate(outFd, outPosition) != 0)
+				return false;
+			offset = data;
+		}
+
+		off_t hole = lseek(inFd, offset, SEEK_HOLE);
+		if(hole < 0 || hole > end)
+			hole = end;
+
+		if(!copyFdData(inFd, offset, outFd, hole - offset))
+			return false;
+		offset = hole;
+	}
+
+	if(sparse)
+		return true;
+#endif
+
+	return copyFdData(inFd, offset, outFd, length);
+}
+
+/* Whether a tool asked to read input ("-" for stdin) has the previous stage's
+ * image to read instead */
+bool Pipe::hasInput(const std::string &input) const
+{
+	return image && input == "-";
+}
+
+/* The tools decompress the files they load, so they get the previous stage's
+ * image decompressed too. It is assembled first, as decompressElf reads the
+ * segments' data. */
+ELFIO::elfio Pipe::takeInput(std::vector<CompressedSegment> &compressed)
+{
+	ELFIO::elfio elf(std::move(*image));
+	image.reset();
+
+	if(findCompressionNote(elf, compressed)) {
+		auto bytes = elf.save_image();
+		if(!bytes || !elf.load(bytes))
+			throw LoadError("Failed to assemble the previous stage's output");
+		decompressElf(elf, compressed);
+	}
+
+	return elf;
+}
+
+ELFIO::elfio Pipe::takeInput()
+{
+	std::vector<CompressedSegment> compressed;
+	return takeInput(compressed);
+}
+
+/* The next stage gets the image laid out, so its segments have their file
+ * offsets and sizes as if it had been saved and loaded again. */
+void Pipe::passOn(ELFIO::elfio &&elf)
+{
+	elf.layout();
+	image.reset(new ELFIO::elfio(std::move(elf)));
+}
+
+static const char *const phaseNames[PhaseCount] = {
+	"parse", "load", "copy", "patch", "query", "layout", "save"
+};
+
+/* Starts in the parse phase */
+Stats::Stats() : phaseStart(std::chrono::steady_clock::now()), current(PhaseParse)
+{
+	std::fill(entered, entered + PhaseCount, false);
+	std::fill(seconds, seconds + PhaseCount, 0.0);
+	entered[PhaseParse] = true;
+
+	ELFIO::stats &counters = ELFIO::stats::get();
+	objectsBefore = counters.objects;
+	buffersBefore = counters.buffers;
+	bytesReadBefore = counters.bytes_read;
+	bytesWrittenBefore = counters.bytes_written;
+}
+
+void Stats::enter(Phase phase)
+{
+	auto now = std::chrono::steady_clock::now();
+	seconds[current] += std::chrono::duration<double>(now - phaseStart).count();
+	phaseStart = now;
+	current = phase;
+	entered[phase] = true;
+}
+
+/* Two lines on stderr, e.g.
+ *   objcat: parse 0.02 ms, load 1.31 ms, copy 0.40 ms, layout 0.05 ms, save 2.10 ms, total 3.88 ms
+ *   objcat: bytes read 1048576, bytes written 1052672, sections/segments 40, data buffers 12, peak RSS 5120 KB */
+void Stats::report(const std::string &program)
+{
+	enter(current);
+
+	std::ostringstream times;
+	double total = 0;
+	times << std::fixed << std::setprecision(2);
+	for(int phase = 0; phase < PhaseCount; phase++) {
+		if(!entered[phase])
+			continue;
+		times << phaseNames[phase] << " " << seconds[phase] * 1000 << " ms, ";
+		total += seconds[phase];
+	}
+	times << "total " << total * 1000 << " ms";
+
+	ELFIO::stats &counters = ELFIO::stats::get();
+	struct rusage usage;
+	long peakRssKb = getrusage(RUSAGE_SELF, &usage) == 0 ? usage.ru_maxrss : 0;
+
+	std::cerr << program << ": " << times.str() << "\n"
+		<< program << ": bytes read " << counters.bytes_read - bytesReadBefore
+		<< ", bytes written " << counters.bytes_written - bytesWrittenBefore
+		<< ", sections/segments " << counters.objects - objectsBefore
+		<< ", data buffers " << counters.buffers - buffersBefore
+		<< ", peak RSS " << peakRssKb << " KB\n";
+}
+
+/* Lay out and save as separate phases */
+bool saveElf(ELFIO::elfio &elf, const std::string &output, Stats &stats)
+{
+	stats.enter(PhaseLayout);
+	if(!elf.layout())
+		return false;
+
+	stats.enter(PhaseSave);
+	return elf.save_laid_out(output);
+}
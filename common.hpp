@@ -1,4 +1,5 @@
 #include <vector>
+#include <chrono>
 #include "elfio/elfio.hpp"
 
 struct LoadError : public std::runtime_error
@@ -6,7 +7,55 @@ struct LoadError : public std::runtime_error
 	LoadError(std::string const &message) : std::runtime_error(message) { }
 };
 
+struct ParseError : public std::runtime_error {
+	ParseError(std::string const &message) : std::runtime_error(message) { }
+};
+
 void copyElfData(ELFIO::elfio &dest, ELFIO::elfio &src);
+/* Compressed images, as written by objcat -z. The file data of each
+ * compressed PT_LOAD segment is an LZ4 block, and a "saruman" note in a
+ * PT_NOTE segment lists those segments. */
+static const ELFIO::Elf_Word NoteCompressedSegments = 1;
+static const uint32_t CompressionCodecLz4 = 1;
+
+struct CompressedSegment {
+	uint32_t segmentIndex;
+	uint32_t codec;
+	uint64_t fileSize;        /* once decompressed */
+	uint64_t compressedSize;
+};
+
+std::vector<char> compressLz(const char *src, size_t length);
+bool decompressLz(const char *src, size_t srcLength, char *dest, size_t destLength);
+void addCompressionNote(ELFIO::elfio &elf, const std::vector<CompressedSegment> &segments);
+bool findCompressionNote(ELFIO::elfio &elf, std::vector<CompressedSegment> &segments);
+bool decompressElf(ELFIO::elfio &elf);
+bool decompressElf(ELFIO::elfio &elf, std::vector<CompressedSegment> &compressed);
+void recompressElf(ELFIO::elfio &elf, const std::vector<CompressedSegment> &compressed);
+
 ELFIO::elfio newFromTemplate(ELFIO::elfio &templ, ELFIO::Elf64_Addr orEntry=0);
 ELFIO::elfio loadElf(const std::string &input);
-std::vector<ELFIO::elfio> loadElves(std::vector<std::string> &filenames);
+std::vector<ELFIO::elfio> loadElves(std::vector<std::string> &filenames, unsigned jobs=1);
+bool writeAll(int fd, const char *bytes, size_t length);
+bool copyFdRange(int inFd, off_t offset, int outFd, size_t length);
+
+/* What --stats reports: the time spent in each phase of a tool run, and how
+ * much reading, writing and allocating elfio did meanwhile. Timing a phase
+ * costs a clock read, so tools keep a Stats whether or not it is shown. */
+enum Phase { PhaseParse, PhaseLoad, PhaseCopy, PhasePatch, PhaseQuery, PhaseLayout, PhaseSave, PhaseCount };
+
+class Stats {
+public:
+	Stats();
+	void enter(Phase phase);
+	void report(const std::string &program);
+
+private:
+	std::chrono::steady_clock::time_point phaseStart;
+	Phase current;
+	bool entered[PhaseCount];
+	double seconds[PhaseCount];
+	uint64_t objectsBefore, buffersBefore, bytesReadBefore, bytesWrittenBefore;
+};
+
+bool saveElf(ELFIO::elfio &elf, const std::string &output, Stats &stats);
@@ -402,6 +402,7 @@ typedef uint64_t Elf64_Off;
 #define SHT_GROUP                 17
 #define SHT_SYMTAB_SHNDX          18
 #define SHT_LOOS          0x60000000
+#define SHT_GNU_HASH      0x6ffffff6
 #define SHT_HIOS          0x6fffffff
 #define SHT_LOPROC        0x70000000
 #define SHT_HIPROC        0x7FFFFFFF
@@ -569,6 +570,7 @@ typedef uint64_t Elf64_Off;
 #define DT_MAXPOSTAGS       34
 #define DT_LOOS     0x6000000D
 #define DT_HIOS     0x6ffff000
+#define DT_GNU_HASH 0x6ffffef5
 #define DT_LOPROC   0x70000000
 #define DT_HIPROC   0x7FFFFFFF
 
@@ -40,13 +40,19 @@ THE SOFTWARE.
 #include <typeinfo>
 #include <sstream>
 #include <cassert>
+#include <memory>
+#include <unordered_map>
 
 #include <elfio/elf_types.hpp>
 #include <elfio/elfio_utils.hpp>
+#include <elfio/elfio_stats.hpp>
+#include <elfio/elfio_arena.hpp>
+#include <elfio/elfio_image.hpp>
 #include <elfio/elfio_header.hpp>
 #include <elfio/elfio_section.hpp>
 #include <elfio/elfio_segment.hpp>
 #include <elfio/elfio_strings.hpp>
+#include <elfio/elfio_index.hpp>
 
 #define ELFIO_HEADER_ACCESS_GET( TYPE, FNAME ) \
 TYPE                                           \
@@ -77,10 +83,13 @@ class elfio
 {
   public:
 //------------------------------------------------------------------------------
-    elfio() : sections( this ), segments( this )
+    elfio() : sections( this ), segments( this ),
+        generation( new Elf_Xword( 1 ) ), indexed_generation( 0 ),
+        pool( new arena )
     {
         header           = 0;
         current_file_pos = 0;
+        section_table_omitted = false;
         create( ELFCLASS32, ELFDATA2LSB );
     }
 
@@ -93,8 +102,25 @@ class elfio
 		segments_ = std::move(rhs.segments_);
 		convertor = std::move(rhs.convertor);
 		name = std::move(rhs.name);
+		image = std::move(rhs.image);
+		borrowed_images = std::move(rhs.borrowed_images);
+
+		/* The sections and segments keep pointing at the same counter */
+		generation = std::move(rhs.generation);
+		indexed_generation = 0;
+		/* ...and are still in the same arena */
+		pool = std::move(rhs.pool);
+
+		/* Leave rhs empty but usable, so that it can be create()d again */
+		rhs.sections_.clear();
+		rhs.segments_.clear();
+		rhs.shstrtab_builder.reset();
+		rhs.generation.reset(new Elf_Xword(1));
+		rhs.indexed_generation = 0;
+		rhs.pool.reset(new arena);
 
 		current_file_pos = rhs.current_file_pos;
+		section_table_omitted = rhs.section_table_omitted;
 	}
 
 	elfio(const elfio &) = delete;
@@ -116,47 +142,98 @@ class elfio
     }
 
 //------------------------------------------------------------------------------
+    // The whole file is read into one buffer, which the sections and
+    // segments then refer into.
     bool load( const std::string& file_name )
     {
-        std::ifstream stream;
-        stream.open( file_name.c_str(), std::ios::in | std::ios::binary );
-        if ( !stream ) {
+        std::shared_ptr<file_image> buffer = file_image::read_file( file_name );
+        if ( !buffer ) {
             return false;
         }
 
 		this->name = file_name;
-        return load(stream);
+        return load( buffer );
     }
 
-	bool load_nonseekable(std::istream &stream)
-	{
-		// brrrr
-		stream >> std::noskipws;
+//------------------------------------------------------------------------------
+    // Map the file rather than reading it. Section and segment data then
+    // points straight into the mapping until it is modified.
+    bool load_mapped( const std::string& file_name )
+    {
+        std::shared_ptr<file_image> mapped = file_image::map_file( file_name );
+        if ( !mapped ) {
+            return false;
+        }
 
-		std::istream_iterator<char> it(std::cin);
-		std::istream_iterator<char> end;
-		std::string buf(it, end);
-		std::istringstream seekable_stream(std::move(buf));
+        this->name = file_name;
+        return load( mapped );
+    }
 
-		return load(seekable_stream);
-	}
+//------------------------------------------------------------------------------
+    // Like load_mapped, but only the headers are read up front. The bytes of
+    // each section and segment are read from disk when get_data() is first
+    // called on it, so tools that look at a few sections of a large file
+    // never read the rest.
+    bool load_lazy( const std::string& file_name )
+    {
+        std::shared_ptr<file_image> mapped = file_image::map_file( file_name, true );
+        if ( !mapped ) {
+            return false;
+        }
+
+        this->name = file_name;
+        return load( mapped );
+    }
 
 //------------------------------------------------------------------------------
-    bool load( std::istream &stream )
+    // Load from a descriptor that may be a pipe, e.g. stdin. If it turns
+    // out to be a regular file it is mapped, lazily if requested.
+    bool load_fd( int fd, bool lazy = false )
     {
-        clean();
+        std::shared_ptr<file_image> ingested = file_image::read_fd( fd, lazy );
+        if ( !ingested ) {
+            return false;
+        }
+
+        return load( ingested );
+    }
 
-        unsigned char e_ident[EI_NIDENT];
+//------------------------------------------------------------------------------
+    bool load_nonseekable( std::istream& stream )
+    {
+        std::shared_ptr<file_image> ingested = file_image::read_stream( stream );
+        if ( !ingested ) {
+            return false;
+        }
+
+        return load( ingested );
+    }
 
-        // Read ELF file signature
+//------------------------------------------------------------------------------
+    // A seekable stream is read from its start, as elfio always has; one
+    // that can't seek, such as a pipe on std::cin, from where it is.
+    bool load( std::istream& stream )
+    {
         stream.seekg( 0 );
-        stream.read( reinterpret_cast<char*>( &e_ident ), sizeof( e_ident ) );
+        if ( !stream ) {
+            stream.clear();
+        }
+
+        return load_nonseekable( stream );
+    }
+
+//------------------------------------------------------------------------------
+    bool load( std::shared_ptr<file_image> new_image )
+    {
+        clean();
 
         // Is it ELF file?
-        if ( stream.gcount() != sizeof( e_ident ) ||
-             e_ident[EI_MAG0] != ELFMAG0    ||
-             e_ident[EI_MAG1] != ELFMAG1    ||
-             e_ident[EI_MAG2] != ELFMAG2    ||
+        const unsigned char* e_ident = reinterpret_cast<const unsigned char*>(
+            new_image->view( 0, EI_NIDENT ) );
+        if ( 0 == e_ident               ||
+             e_ident[EI_MAG0] != ELFMAG0 ||
+             e_ident[EI_MAG1] != ELFMAG1 ||
+             e_ident[EI_MAG2] != ELFMAG2 ||
              e_ident[EI_MAG3] != ELFMAG3 ) {
             return false;
         }
@@ -172,12 +249,15 @@ class elfio
         if ( 0 == header ) {
             return false;
         }
-        if ( !header->load( stream ) ) {
+        if ( !header->load( *new_image ) ) {
             return false;
         }
 
-        load_sections( stream );
-        load_segments( stream );
+        image = new_image;
+        load_sections( *image );
+        load_segments( *image );
+        // The headers were read directly rather than through the setters
+        note_change();
 
         return true;
     }
@@ -194,8 +274,8 @@ class elfio
         // before saving.
         header->set_segments_num( segments.size() );
         header->set_segments_offset( segments.size() ? header->get_header_size() : 0 );
-        header->set_sections_num( sections.size() );
         header->set_sections_offset( 0 );
+        set_section_numbering();
 
         // Layout the first section right after the segment table
         current_file_pos = header->get_header_size() +
@@ -209,43 +289,80 @@ class elfio
 	}
 
   private:
-	bool save_without_layout(std::ostream &f)
+    // Assemble the laid-out file in a single buffer of exactly its size.
+	std::shared_ptr<file_image> save_without_layout()
 	{
+        std::shared_ptr<file_image> f = file_image::allocate( size() );
+        if ( !f ) {
+            return 0;
+        }
+
 		bool is_still_good;
 
-        is_still_good = save_header( f );
-        is_still_good = is_still_good && save_sections( f );
-        is_still_good = is_still_good && save_segments( f );
+        if ( section_table_omitted ) {
+            // No section table, so no section name table either
+            Elf_Word shstrndx = get_section_name_str_index();
+            set_section_name_str_index( SHN_UNDEF );
+            is_still_good = save_header( *f );
+            set_section_name_str_index( shstrndx );
+        }
+        else {
+            is_still_good = save_header( *f );
+        }
+        is_still_good = is_still_good && save_sections( *f );
+        is_still_good = is_still_good && save_segments( *f );
 
-        return is_still_good;
+        return is_still_good ? f : 0;
 	}
 
   public:
+//------------------------------------------------------------------------------
+    // Work out the file offsets and segment sizes without saving, so that an
+    // elfio built in memory can be looked at like a loaded one
+    bool layout()
+    {
+        return layout_everything();
+    }
+
+//------------------------------------------------------------------------------
+    // Lay out and assemble the file in memory, e.g. to load() it again
+    std::shared_ptr<file_image> save_image()
+    {
+        if ( !layout_everything() ) {
+            return 0;
+        }
+
+        return save_without_layout();
+    }
+
     bool save( const std::string& file_name )
 	{
 		if(!layout_everything())
 			return false;
 
+        return save_laid_out( file_name );
+    }
+
+//------------------------------------------------------------------------------
+    // Save after layout(), e.g. to time the two separately
+    bool save_laid_out( const std::string& file_name )
+    {
+        std::shared_ptr<file_image> f = save_without_layout();
+        if ( !f ) {
+            return false;
+        }
+
 		if(file_name == "-") {
-			std::string buf(size(), '\0');
-			std::ostringstream f(std::move(buf));
-
-			if(save_without_layout(f)) {
-				std::string bytes = f.str();
-				std::cout.write(bytes.data(), bytes.length());
-				return true;
-			} else {
-				return false;
-			}
+			std::cout.flush();
+			return f->write_fd( STDOUT_FILENO );
 		} else {
-			std::ofstream f( file_name.c_str(), std::ios::out | std::ios::binary );
-			if ( !f ) {
+			int fd = ::open( file_name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666 );
+			if ( fd < 0 ) {
 				return false;
 			}
 
-			bool is_still_good = save_without_layout(f);
-
-			f.close();
+			bool is_still_good = f->write_fd( fd );
+			is_still_good = ( ::close( fd ) == 0 ) && is_still_good;
 
 			return is_still_good;
 		}
@@ -256,7 +373,13 @@ class elfio
 		if(!layout_everything())
 			return false;
 
-		return save_without_layout(f);
+        std::shared_ptr<file_image> assembled = save_without_layout();
+        if ( !assembled ) {
+            return false;
+        }
+
+        f.write( assembled->view( 0, assembled->get_size() ), assembled->get_size() );
+        return f.good();
     }
 
 //------------------------------------------------------------------------------
@@ -277,7 +400,39 @@ class elfio
     ELFIO_HEADER_ACCESS_GET_SET( Elf64_Addr,    entry                  );
     ELFIO_HEADER_ACCESS_GET_SET( Elf64_Off,     sections_offset        );
     ELFIO_HEADER_ACCESS_GET_SET( Elf64_Off,     segments_offset        );
-    ELFIO_HEADER_ACCESS_GET_SET( Elf_Half,      section_name_str_index );
+
+//------------------------------------------------------------------------------
+    // With extended section numbering the header holds SHN_XINDEX, and the
+    // real index is in the sh_link of section 0
+    Elf_Word get_section_name_str_index() const
+    {
+        assert( header );
+        Elf_Half index = header->get_section_name_str_index();
+        if ( SHN_XINDEX == index && !sections_.empty() ) {
+            return sections_[0]->get_link();
+        }
+        return index;
+    }
+
+    void set_section_name_str_index( Elf_Word index )
+    {
+        assert( header );
+        if ( index >= SHN_LORESERVE && !sections_.empty() ) {
+            header->set_section_name_str_index( SHN_XINDEX );
+            sections_[0]->set_link( index );
+        }
+        else {
+            header->set_section_name_str_index( (Elf_Half)index );
+        }
+    }
+
+//------------------------------------------------------------------------------
+    // When omitted, only the contents of sections in segments are saved,
+    // and the file has no section headers
+    void omit_section_table( bool omit )
+    {
+        section_table_omitted = omit;
+    }
 
 //------------------------------------------------------------------------------
     const endianess_convertor& get_convertor() const
@@ -326,6 +481,10 @@ class elfio
 		return name;
 	}
 
+	void set_name(const std::string &name_) {
+		name = name_;
+	}
+
 //------------------------------------------------------------------------------
   private:
 //------------------------------------------------------------------------------
@@ -336,17 +495,87 @@ class elfio
 
         header = 0;
 
+        // The sections and segments live in the arena, which is freed in
+        // one go once they have been destroyed
         std::vector<section*>::const_iterator it;
         for ( it = sections_.begin(); it != sections_.end(); ++it ) {
-            delete *it;
+            (*it)->~section();
         }
         sections_.clear();
 
         std::vector<segment*>::const_iterator it1;
         for ( it1 = segments_.begin(); it1 != segments_.end(); ++it1 ) {
-            delete *it1;
+            (*it1)->~segment();
         }
         segments_.clear();
+
+        pool->clear();
+
+        image.reset();
+        borrowed_images.clear();
+        shstrtab_builder.reset();
+        note_change();
+    }
+
+//------------------------------------------------------------------------------
+    void note_change()
+    {
+        if ( generation ) {
+            ++*generation;
+        }
+    }
+
+//------------------------------------------------------------------------------
+    // Brings the address and name index up to date with the sections and
+    // segments, if anything has changed since it was last built
+    void update_index() const
+    {
+        if ( indexed_generation == *generation ) {
+            return;
+        }
+
+        section_addresses.clear();
+        section_names.clear();
+        for ( size_t i = 0; i < sections_.size(); ++i ) {
+            section* sec = sections_[i];
+            // Sections which aren't loaded, like .symtab or .debug_info, have
+            // no place in memory, though most claim to be at address 0
+            if ( sec->get_flags() & SHF_ALLOC ) {
+                section_addresses.add( sec->get_address(), sec->get_size(),
+                                       sec, i, sec->get_type() );
+            }
+            // The first section with a name wins, as for a linear search
+            section_names.insert( std::make_pair( sec->get_name(), sec ) );
+        }
+        section_addresses.build();
+
+        segment_addresses.clear();
+        for ( size_t i = 0; i < segments_.size(); ++i ) {
+            segment* seg = segments_[i];
+            segment_addresses.add( seg->get_virtual_address(),
+                                   seg->get_memory_size(), seg, i,
+                                   seg->get_type() );
+        }
+        segment_addresses.build();
+
+        indexed_generation = *generation;
+    }
+
+//------------------------------------------------------------------------------
+    // The owning pointer for an image that sections of this elfio refer to
+    std::shared_ptr<file_image> find_image( const file_image* target ) const
+    {
+        if ( image.get() == target ) {
+            return image;
+        }
+
+        for ( auto& borrowed : borrowed_images ) {
+            if ( borrowed.get() == target ) {
+                return borrowed;
+            }
+        }
+
+        return 0;
     }
 
 //------------------------------------------------------------------------------
@@ -376,17 +605,19 @@ class elfio
         unsigned char file_class = get_class();
 
         if ( file_class == ELFCLASS64 ) {
-            new_section = new section_impl<Elf64_Shdr>( convertor );
+            new_section = pool->create< section_impl<Elf64_Shdr> >( convertor, generation.get(), pool.get() );
         }
         else if ( file_class == ELFCLASS32 ) {
-            new_section = new section_impl<Elf32_Shdr>( convertor );
+            new_section = pool->create< section_impl<Elf32_Shdr> >( convertor, generation.get(), pool.get() );
         }
         else {
             return 0;
         }
 
-        new_section->set_index( (Elf_Half)sections_.size() );
+        new_section->set_index( (Elf_Word)sections_.size() );
         sections_.push_back( new_section );
+        stats::count( stats::get().objects );
+        note_change();
 
         return new_section;
     }
@@ -399,10 +630,10 @@ class elfio
         unsigned char file_class = header->get_class();
 
         if ( file_class == ELFCLASS64 ) {
-            new_segment = new segment_impl<Elf64_Phdr>( convertor );
+            new_segment = pool->create< segment_impl<Elf64_Phdr> >( convertor, generation.get() );
         }
         else if ( file_class == ELFCLASS32 ) {
-            new_segment = new segment_impl<Elf32_Phdr>( convertor );
+            new_segment = pool->create< segment_impl<Elf32_Phdr> >( convertor, generation.get() );
         }
         else {
             return 0;
@@ -410,6 +641,8 @@ class elfio
 
         new_segment->set_index( (Elf_Half)segments_.size() );
         segments_.push_back( new_segment );
+        stats::count( stats::get().objects );
+        note_change();
 
         return new_segment;
     }
@@ -430,34 +663,50 @@ class elfio
         shstrtab->set_addr_align( 1 );
     }
 
+	/* Their memory stays in the arena until clean() */
 	void delete_all_sections() {
 		for(auto section: sections_) {
-			delete section;
+			section->~section();
 		}
 		sections_.clear();
+		shstrtab_builder.reset();
+		note_change();
 	}
 
 //------------------------------------------------------------------------------
-    Elf_Half load_sections( std::istream& stream )
+    Elf_Word load_sections( file_image& source )
     {
         Elf_Half  entry_size = header->get_section_entry_size();
-        Elf_Half  num        = header->get_sections_num();
+        Elf_Word  num        = header->get_sections_num();
         Elf64_Off offset     = header->get_sections_offset();
 
-        for ( Elf_Half i = 0; i < num; ++i ) {
+        // With extended section numbering, e_shnum is 0 and the count is in
+        // the sh_size of section 0. It is only believed as far as the file
+        // has room for the headers.
+        if ( 0 == num && 0 != offset && 0 != entry_size &&
+             offset < source.get_size() ) {
+            section* sec0 = create_section();
+            sec0->load( source, offset );
+            sec0->set_address( sec0->get_address() );
+            Elf_Xword room = ( source.get_size() - offset ) / entry_size;
+            num = (Elf_Word)std::max<Elf_Xword>(
+                std::min( sec0->get_size(), room ), 1 );
+        }
+
+        for ( Elf_Word i = sections_.size(); i < num; ++i ) {
             section* sec = create_section();
-            sec->load( stream, (std::streamoff)offset + i * entry_size );
+            sec->load( source, offset + i * entry_size );
             sec->set_index( i );
             // To mark that the section is not permitted to reassign address
             // during layout calculation
             sec->set_address( sec->get_address() );
         }
 
-        Elf_Half shstrndx = get_section_name_str_index();
+        Elf_Word shstrndx = get_section_name_str_index();
 
-        if ( SHN_UNDEF != shstrndx ) {
+        if ( SHN_UNDEF != shstrndx && shstrndx < num ) {
             string_section_accessor str_reader( sections[shstrndx] );
-            for ( Elf_Half i = 0; i < num; ++i ) {
+            for ( Elf_Word i = 0; i < num; ++i ) {
                 Elf_Word offset = sections[i]->get_name_string_offset();
                 const char* p = str_reader.get_string( offset );
                 if ( p != 0 ) {
@@ -470,7 +719,7 @@ class elfio
     }
 
 //------------------------------------------------------------------------------
-    bool load_segments( std::istream& stream )
+    bool load_segments( file_image& source )
     {
         Elf_Half  entry_size = header->get_segment_entry_size();
         Elf_Half  num        = header->get_segments_num();
@@ -481,24 +730,25 @@ class elfio
             unsigned char file_class = header->get_class();
 
             if ( file_class == ELFCLASS64 ) {
-                seg = new segment_impl<Elf64_Phdr>( convertor );
+                seg = pool->create< segment_impl<Elf64_Phdr> >( convertor, generation.get() );
             }
             else if ( file_class == ELFCLASS32 ) {
-                seg = new segment_impl<Elf32_Phdr>( convertor );
+                seg = pool->create< segment_impl<Elf32_Phdr> >( convertor, generation.get() );
             }
             else {
                 return false;
             }
 
-            seg->load( stream, (std::streamoff)offset + i * entry_size );
+            seg->load( source, offset + i * entry_size );
             seg->set_index( i );
+            stats::count( stats::get().objects );
 
             // Add sections to the segments (similar to readelfs algorithm)
             Elf64_Off segBaseOffset = seg->get_offset();
             Elf64_Off segEndOffset  = segBaseOffset + seg->get_file_size();
             Elf64_Off segVBaseAddr = seg->get_virtual_address();
             Elf64_Off segVEndAddr  = segVBaseAddr + seg->get_memory_size();
-            for( Elf_Half j = 0; j < sections.size(); ++j ) {
+            for( Elf_Word j = 0; j < sections.size(); ++j ) {
                 const section* psec = sections[j];
 
                 // SHF_ALLOC sections are matched based on the virtual address
@@ -517,33 +767,76 @@ class elfio
 
             // Add section into the segments' container
             segments_.push_back( seg );
+            note_change();
         }
 
         return true;
     }
 
+//------------------------------------------------------------------------------
+    // From SHN_LORESERVE sections up, e_shnum is 0 and e_shstrndx SHN_XINDEX,
+    // and section 0 holds the real values in sh_size and sh_link. Only what
+    // differs is set, so laying out again leaves the index valid.
+    void set_section_numbering()
+    {
+        Elf_Word count    = section_table_omitted ? 0 : sections_.size();
+        Elf_Word shstrndx = get_section_name_str_index();
+        bool     extended = count >= SHN_LORESERVE;
+
+        header->set_sections_num( extended ? 0 : (Elf_Half)count );
+        if ( sections_.empty() ) {
+            return;
+        }
+
+        section*  sec0 = sections_[0];
+        Elf_Xword size = extended ? count : 0;
+        Elf_Word  link = extended || shstrndx >= SHN_LORESERVE ? shstrndx : 0;
+        if ( sec0->get_size() != size ) {
+            sec0->set_size( size );
+        }
+        if ( sec0->get_link() != link ) {
+            sec0->set_link( link );
+        }
+        header->set_section_name_str_index(
+            link != 0 ? SHN_XINDEX : (Elf_Half)shstrndx );
+    }
+
+//------------------------------------------------------------------------------
 	size_t size()
 	{
 		/* Not very nice -- relies on the layout behaviour of elfio which
 		 * always puts section headers at the end of the file. */
+		if(section_table_omitted)
+			return current_file_pos;
 
 		return header->get_sections_offset() + header->get_section_entry_size() * sections_.size();
 	}
 
 //------------------------------------------------------------------------------
-    bool save_header( std::ostream& f )
+    bool save_header( file_image& f )
     {
         return header->save( f );
     }
 
 //------------------------------------------------------------------------------
-    bool save_sections( std::ostream& f )
+    bool save_sections( file_image& f )
     {
+        if ( section_table_omitted ) {
+            // Only the contents of the sections which are loaded
+            std::vector<bool> in_segment = get_sections_in_segments();
+            for ( unsigned int i = 0; i < sections_.size(); ++i ) {
+                if ( in_segment[i] ) {
+                    sections_[i]->save_contents( f, sections_[i]->get_offset() );
+                }
+            }
+            return true;
+        }
+
         for ( unsigned int i = 0; i < sections_.size(); ++i ) {
             section *sec = sections_.at(i);
 
-            std::streampos headerPosition =
-                (std::streamoff)header->get_sections_offset() +
+            Elf64_Off headerPosition =
+                header->get_sections_offset() +
                 header->get_section_entry_size() * sec->get_index();
 
             sec->save(f,headerPosition,sec->get_offset());
@@ -552,12 +845,12 @@ class elfio
     }
 
 //------------------------------------------------------------------------------
-    bool save_segments( std::ostream& f )
+    bool save_segments( file_image& f )
     {
         for ( unsigned int i = 0; i < segments_.size(); ++i ) {
             segment *seg = segments_.at(i);
 
-            std::streampos headerPosition = header->get_segments_offset()  +
+            Elf64_Off headerPosition = header->get_segments_offset()  +
                 header->get_segment_entry_size()*seg->get_index();
 
             seg->save( f, headerPosition, seg->get_offset() );
@@ -566,27 +859,29 @@ class elfio
     }
 
 //------------------------------------------------------------------------------
-    bool is_section_without_segment( unsigned int section_index )
+    // For each section index, whether any segment lists it
+    std::vector<bool> get_sections_in_segments() const
     {
-        bool found = false;
-        
-        for ( unsigned int j = 0; !found && ( j < segments.size() ); ++j ) {
-            for ( unsigned int k = 0;
-                  !found && ( k < segments[j]->get_sections_num() );
-                  ++k ) {
-                found = segments[j]->get_section_index_at( k ) == section_index;
+        std::vector<bool> in_segment( sections_.size(), false );
+
+        for ( const segment* seg : segments_ ) {
+            for ( Elf_Word index : seg->get_sections() ) {
+                if ( index >= in_segment.size() ) {
+                    in_segment.resize( index + 1, false );
+                }
+                in_segment[index] = true;
             }
         }
 
-        return !found;
+        return in_segment;
     }
 
 //------------------------------------------------------------------------------
     bool is_subsequence_of( segment* seg1, segment* seg2 )
     {
         // Return 'true' if sections of seg1 are a subset of sections in seg2
-        const std::vector<Elf_Half>& sections1 = seg1->get_sections();
-        const std::vector<Elf_Half>& sections2 = seg2->get_sections();
+        const std::vector<Elf_Word>& sections1 = seg1->get_sections();
+        const std::vector<Elf_Word>& sections2 = seg2->get_sections();
 
         bool found = false;
         if ( sections1.size() <  sections2.size() ) {
@@ -617,21 +912,72 @@ class elfio
             }
         }
 
+        // A segment goes after every other segment whose sections include
+        // its own. Rather than checking each segment against all the others
+        // whenever it reaches the front of the worklist, find out up front
+        // which segments include which: a segment can only be included by
+        // segments which list its least shared section.
+        std::unordered_map<const segment*, size_t> position;
+        std::vector< std::vector<size_t> >          section_members;
+        for ( size_t j = 0; j < segments_.size(); ++j ) {
+            position[segments_[j]] = j;
+            for ( Elf_Word index : segments_[j]->get_sections() ) {
+                if ( index >= section_members.size() ) {
+                    section_members.resize( index + 1 );
+                }
+                std::vector<size_t>& members = section_members[index];
+                if ( members.empty() || members.back() != j ) {
+                    members.push_back( j );
+                }
+            }
+        }
+
+        std::vector< std::vector<size_t> > included( segments_.size() );
+        std::vector<size_t> including( segments_.size(), 0 );
+        size_t              with_sections = 0;
+        for ( size_t j = 0; j < segments_.size(); ++j ) {
+            const std::vector<Elf_Word>& own = segments_[j]->get_sections();
+            if ( own.empty() ) {
+                // Included by every segment that has any sections
+                continue;
+            }
+            ++with_sections;
+
+            Elf_Word rarest = own[0];
+            for ( Elf_Word index : own ) {
+                if ( section_members[index].size() <
+                     section_members[rarest].size() ) {
+                    rarest = index;
+                }
+            }
+            for ( size_t k : section_members[rarest] ) {
+                if ( k != j && is_subsequence_of( segments_[j], segments_[k] ) ) {
+                    included[k].push_back( j );
+                    ++including[j];
+                }
+            }
+        }
+
+        // The same passes over the worklist as comparing against every
+        // remaining segment would make, but each check is now O(1)
         while ( !worklist.empty() ) {
             segment *seg = worklist.front();
             worklist.pop_front();
 
-            size_t i = 0;
-            for ( ; i < worklist.size(); ++i ) {
-                if ( is_subsequence_of( seg, worklist[i] ) ) {
-                    break;
-                }
+            size_t j = position[seg];
+            bool   is_empty = seg->get_sections().empty();
+            if ( is_empty ? with_sections > 0 : including[j] > 0 ) {
+                worklist.push_back(seg);
+                continue;
             }
 
-            if ( i < worklist.size() )
-                worklist.push_back(seg);
-            else
-                res.push_back(seg);
+            res.push_back(seg);
+            for ( size_t k : included[j] ) {
+                --including[k];
+            }
+            if ( !is_empty ) {
+                --with_sections;
+            }
         }
 
         return res;
@@ -641,8 +987,15 @@ class elfio
 //------------------------------------------------------------------------------
     bool layout_sections_without_segments( )
     {
+        if ( section_table_omitted ) {
+            // Nothing refers to them
+            return true;
+        }
+
+        std::vector<bool> in_segment = get_sections_in_segments();
+
         for ( unsigned int i = 0; i < sections_.size(); ++i ) {
-            if ( is_section_without_segment( i ) ) {
+            if ( !in_segment[i] ) {
                 section *sec = sections_[i];
 
                 Elf_Xword section_align = sec->get_addr_align();
@@ -714,7 +1067,7 @@ class elfio
 
             // Write segment's data
             for ( unsigned int j = 0; j < seg->get_sections_num(); ++j ) {
-                Elf_Half index = seg->get_section_index_at( j );
+                Elf_Word index = seg->get_section_index_at( j );
 
                 section* sec = sections[ index ];
 
@@ -790,6 +1143,11 @@ class elfio
 //------------------------------------------------------------------------------
     bool layout_section_table()
     {
+        if ( section_table_omitted ) {
+            header->set_sections_offset( 0 );
+            return true;
+        }
+
         // Simply place the section table at the end for now
         Elf64_Off alignmentError = current_file_pos % 4;
         current_file_pos += ( 4 - alignmentError ) % 4;
@@ -810,9 +1168,9 @@ class elfio
         }
 
 //------------------------------------------------------------------------------
-        Elf_Half size() const
+        Elf_Word size() const
         {
-            return (Elf_Half)parent->sections_.size();
+            return (Elf_Word)parent->sections_.size();
         }
 
 //------------------------------------------------------------------------------
@@ -830,34 +1188,54 @@ class elfio
 //------------------------------------------------------------------------------
         section* operator[]( const std::string& name ) const
         {
-            section* sec = 0;
+            parent->update_index();
 
-            std::vector<section*>::const_iterator it;
-            for ( it = parent->sections_.begin();
-                  it != parent->sections_.end();
-                  ++it ) {
-                if ( (*it)->get_name() == name ) {
-                    sec = *it;
-                    break;
-                }
-            }
+            std::unordered_map<std::string, section*>::const_iterator it =
+                parent->section_names.find( name );
 
-            return sec;
+            return it == parent->section_names.end() ? 0 : it->second;
+        }
+
+//------------------------------------------------------------------------------
+        // The first SHF_ALLOC section of the given type whose address range
+        // contains 'address', or 0
+        section* find_by_address( Elf64_Addr address, Elf_Word type ) const
+        {
+            parent->update_index();
+
+            return parent->section_addresses.find( address, type );
         }
 
 //------------------------------------------------------------------------------
         section* add( const std::string& name )
         {
-            section* new_section = parent->create_section();
-            new_section->set_name( name );
+            return add( std::vector<std::string>( 1, name ) )[0];
+        }
+
+//------------------------------------------------------------------------------
+        // Adds a section for each name. Names already in the section name
+        // table, or which are the end of one, are not added to it again.
+        std::vector<section*> add( const std::vector<std::string>& names )
+        {
+            parent->sections_.reserve( parent->sections_.size() + names.size() );
+            std::vector<section*> new_sections;
+            new_sections.reserve( names.size() );
+            for ( size_t i = 0; i < names.size(); ++i ) {
+                section* new_section = parent->create_section();
+                new_section->set_name( names[i] );
+                new_sections.push_back( new_section );
+            }
 
-            Elf_Half str_index = parent->get_section_name_str_index();
+            // The string table may be one of the new sections
+            Elf_Word str_index = parent->get_section_name_str_index();
             section* string_table( parent->sections_[str_index] );
-            string_section_accessor str_writer( string_table );
-            Elf_Word pos = str_writer.add_string( name );
-            new_section->set_name_string_offset( pos );
+            std::vector<Elf_Word> offsets =
+                parent->shstrtab_builder.add_strings( string_table, names );
+            for ( size_t i = 0; i < names.size(); ++i ) {
+                new_sections[i]->set_name_string_offset( offsets[i] );
+            }
 
-            return new_section;
+            return new_sections;
         }
 
 		void duplicate(Sections &rhs)
@@ -872,7 +1250,7 @@ class elfio
 				dst->set_type(src->get_type());
 				dst->set_flags(src->get_flags());
 				dst->set_addr_align(src->get_addr_align());
-				dst->set_data(src->get_data(), src->get_size());
+				share_data(dst, src, rhs.parent);
 				dst->set_address(src->get_address());
 				dst->set_name_string_offset(src->get_name_string_offset());
 			}
@@ -888,8 +1266,59 @@ class elfio
             return parent->sections_.end();
         }
 
+//------------------------------------------------------------------------------
+        // Gives dst the file data of a segment of src_elf, shared as by
+        // duplicate() while it is still in src_elf's file image. dst's size
+        // is left to the caller.
+        void share_data( section* dst, const segment* src, elfio& src_elf )
+        {
+            Elf64_Off   offset;
+            Elf_Xword   length;
+            file_image* src_image = src->get_image( offset, length );
+            if ( 0 == src_image ||
+                 !share_image( dst, src_image, offset, length, &src_elf ) ) {
+                dst->set_data( src->get_data(), src->get_file_size() );
+            }
+        }
+
 //------------------------------------------------------------------------------
       private:
+        // Contents still in the source's file image are shared rather than
+        // copied. The image is then copy-on-write for both elfio objects: a
+        // section gets a private copy when it is modified.
+        void share_data( section* dst, section* src, elfio* src_parent )
+        {
+            Elf64_Off   offset;
+            Elf_Xword   length;
+            file_image* src_image = src->get_image( offset, length );
+            if ( 0 == src_image || src->get_type() == SHT_NOBITS ||
+                 !share_image( dst, src_image, offset, length, src_parent ) ) {
+                dst->set_data( src->get_data(), src->get_size() );
+                return;
+            }
+
+            dst->set_size( src->get_size() );
+        }
+
+//------------------------------------------------------------------------------
+        bool share_image( section* dst, file_image* src_image, Elf64_Off offset,
+                          Elf_Xword length, elfio* src_parent )
+        {
+            std::shared_ptr<file_image> owner =
+                src_parent->find_image( src_image );
+            if ( !owner ) {
+                return false;
+            }
+
+            owner->mark_shared();
+            if ( !parent->find_image( src_image ) ) {
+                parent->borrowed_images.push_back( owner );
+            }
+            dst->set_image( src_image, offset, length );
+            return true;
+        }
+
+//------------------------------------------------------------------------------
         elfio* parent;
     } sections;
 
@@ -923,6 +1352,16 @@ class elfio
             return parent->create_segment();
         }
 
+//------------------------------------------------------------------------------
+        // The first segment of the given type whose memory range contains
+        // 'address', or 0
+        segment* find_by_address( Elf64_Addr address, Elf_Word type ) const
+        {
+            parent->update_index();
+
+            return parent->segment_addresses.find( address, type );
+        }
+
 //------------------------------------------------------------------------------
         std::vector<segment*>::iterator begin() {
             return parent->segments_.begin();
@@ -944,8 +1383,22 @@ class elfio
     std::vector<section*> sections_;
     std::vector<segment*> segments_;
     endianess_convertor   convertor;
+    std::shared_ptr<file_image> image;
+    std::vector< std::shared_ptr<file_image> > borrowed_images;
+    string_table_builder  shstrtab_builder;
+
+    // Bumped by any change which affects the index below
+    std::unique_ptr<Elf_Xword>                        generation;
+    mutable Elf_Xword                                 indexed_generation;
+    mutable address_index<section>                    section_addresses;
+    mutable address_index<segment>                    segment_addresses;
+    mutable std::unordered_map<std::string, section*> section_names;
+
+    // Where the sections and segments and their buffers are allocated
+    std::unique_ptr<arena> pool;
 
     Elf_Xword current_file_pos;
+    bool      section_table_omitted;
 	std::string           name;
 };
 
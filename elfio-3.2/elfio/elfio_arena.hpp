@@ -0,0 +1,172 @@
+/*
+Copyright (C) 2001-2015 by Serge Lamikhov-Center
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef ELFIO_ARENA_HPP
+#define ELFIO_ARENA_HPP
+
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+
+namespace ELFIO {
+
+//------------------------------------------------------------------------------
+// Memory for the sections and segments of one elfio. The objects, their
+// names and their smaller data buffers are carved out of a few large blocks,
+// next to each other in the order they were made, and are all freed at once
+// by clear(). Nothing allocated here is freed on its own, with one
+// exception: buffers of more than large_buffer bytes get their own
+// allocation, and release_buffer() frees them straight away, so replacing a
+// big section's contents doesn't keep the old copy alive.
+class arena
+{
+  public:
+    static const size_t large_buffer = 16 * 1024;
+
+//------------------------------------------------------------------------------
+    arena() : next( 0 ), left( 0 ), block_size( first_block )
+    {
+    }
+
+    ~arena()
+    {
+        clear();
+    }
+
+    arena( const arena& ) = delete;
+    arena& operator=( const arena& ) = delete;
+
+//------------------------------------------------------------------------------
+    void*
+    allocate( size_t size, size_t align = alignof( std::max_align_t ) )
+    {
+        size_t pad = padding( align );
+        if ( 0 == next || pad + size > left ) {
+            add_block( size + align );
+            pad = padding( align );
+        }
+
+        char* allocated = next + pad;
+        next  = allocated + size;
+        left -= pad + size;
+
+        return allocated;
+    }
+
+//------------------------------------------------------------------------------
+    // The caller runs the destructor (see elfio::clean()); the memory goes
+    // with the rest of the arena
+    template< class T, class... Args >
+    T*
+    create( Args&&... args )
+    {
+        return new ( allocate( sizeof( T ), alignof( T ) ) )
+            T( std::forward<Args>( args )... );
+    }
+
+//------------------------------------------------------------------------------
+    // Throws std::bad_alloc, like new char[]
+    char*
+    allocate_buffer( size_t size )
+    {
+        if ( size > large_buffer ) {
+            return new char[size];
+        }
+
+        return static_cast<char*>( allocate( size ) );
+    }
+
+//------------------------------------------------------------------------------
+    // 'size' is as given to allocate_buffer()
+    void
+    release_buffer( char* buffer, size_t size )
+    {
+        if ( size > large_buffer ) {
+            delete [] buffer;
+        }
+    }
+
+//------------------------------------------------------------------------------
+    const char*
+    copy_string( const std::string& str )
+    {
+        char* copy = static_cast<char*>( allocate( str.size() + 1, 1 ) );
+        std::copy( str.c_str(), str.c_str() + str.size() + 1, copy );
+
+        return copy;
+    }
+
+//------------------------------------------------------------------------------
+    void
+    clear()
+    {
+        for ( char* block : blocks ) {
+            delete [] block;
+        }
+        blocks.clear();
+        next       = 0;
+        left       = 0;
+        block_size = first_block;
+    }
+
+//------------------------------------------------------------------------------
+  private:
+    static const size_t first_block = 16 * 1024;
+    static const size_t last_block  = 1024 * 1024;
+
+//------------------------------------------------------------------------------
+    size_t
+    padding( size_t align ) const
+    {
+        return ( align - reinterpret_cast<uintptr_t>( next ) % align ) % align;
+    }
+
+//------------------------------------------------------------------------------
+    // Blocks double in size up to last_block, so that a small file needs
+    // little memory and a large one few blocks. What is left of the
+    // current block is abandoned.
+    void
+    add_block( size_t at_least )
+    {
+        size_t size = std::max( block_size, at_least );
+        blocks.push_back( new char[size] );
+        next       = blocks.back();
+        left       = size;
+        block_size = std::min( block_size * 2, (size_t)last_block );
+    }
+
+//------------------------------------------------------------------------------
+  private:
+    std::vector<char*> blocks;
+    char*              next;
+    size_t             left;
+    size_t             block_size;
+};
+
+} // namespace ELFIO
+
+#endif // ELFIO_ARENA_HPP
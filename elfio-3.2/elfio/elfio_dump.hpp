@@ -446,7 +446,7 @@ class dump
     static void
     section_headers( std::ostream& out, const elfio& reader )
     {
-        Elf_Half n = reader.sections.size();
+        Elf_Word n = reader.sections.size();
 
         if ( n == 0 ) {
             return;
@@ -461,7 +461,7 @@ class dump
                 << "        Lk   Inf  Al      Name" << std::endl;
         }
             
-        for ( Elf_Half i = 0; i < n; ++i ) { // For all sections
+        for ( Elf_Word i = 0; i < n; ++i ) { // For all sections
             section* sec = reader.sections[i];
             section_header( out, i, sec, reader.get_class() );
         }
@@ -472,7 +472,7 @@ class dump
 
 //------------------------------------------------------------------------------
     static void
-    section_header( std::ostream& out, Elf_Half no, const section* sec,
+    section_header( std::ostream& out, Elf_Word no, const section* sec,
                     unsigned char elf_class )
     {
         std::ios_base::fmtflags original_flags = out.flags();
@@ -586,8 +586,8 @@ class dump
     static void
     symbol_tables( std::ostream& out, const elfio& reader )
     {
-        Elf_Half n = reader.sections.size();
-        for ( Elf_Half i = 0; i < n; ++i ) {    // For all sections
+        Elf_Word n = reader.sections.size();
+        for ( Elf_Word i = 0; i < n; ++i ) {    // For all sections
             section* sec = reader.sections[i];
             if ( SHT_SYMTAB == sec->get_type() || SHT_DYNSYM == sec->get_type() ) {
                 symbol_section_accessor symbols( reader, sec );
@@ -115,10 +115,10 @@ class dynamic_section_accessor
 //------------------------------------------------------------------------------
   private:
 //------------------------------------------------------------------------------
-    Elf_Half
+    Elf_Word
     get_string_table_index() const
     {
-        return (Elf_Half)dynamic_section->get_link();
+        return (Elf_Word)dynamic_section->get_link();
     }
 
 //------------------------------------------------------------------------------
@@ -31,8 +31,8 @@ class elf_header
 {
   public:
     virtual ~elf_header() {};
-    virtual bool load( std::istream& stream )       = 0;
-    virtual bool save( std::ostream& stream ) const = 0;
+    virtual bool load( const file_image& image )    = 0;
+    virtual bool save( file_image& image ) const    = 0;
 
     // ELF header functions
     ELFIO_GET_ACCESS_DECL( unsigned char, class              );
@@ -96,21 +96,22 @@ template< class T > class elf_header_impl : public elf_header
     }
 
     bool
-    load( std::istream& stream )
+    load( const file_image& image )
     {
-        stream.seekg( 0 );
-        stream.read( reinterpret_cast<char*>( &header ), sizeof( header ) );
+        const char* raw = image.view( 0, sizeof( header ) );
+        if ( 0 == raw ) {
+            return false;
+        }
 
-        return (stream.gcount() == sizeof( header ) );
+        std::copy( raw, raw + sizeof( header ), reinterpret_cast<char*>( &header ) );
+        return true;
     }
 
     bool
-    save( std::ostream& stream ) const
+    save( file_image& image ) const
     {
-        stream.seekp( 0 );
-        stream.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
-
-        return stream.good();
+        return image.write_at( 0, reinterpret_cast<const char*>( &header ),
+                               sizeof( header ) );
     }
 
     // ELF header functions
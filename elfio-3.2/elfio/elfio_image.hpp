@@ -0,0 +1,620 @@
+/*
+Copyright (C) 2001-2015 by Serge Lamikhov-Center
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef ELFIO_IMAGE_HPP
+#define ELFIO_IMAGE_HPP
+
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <istream>
+#include <cerrno>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+namespace ELFIO {
+
+//------------------------------------------------------------------------------
+// The bytes of a whole input file. Sections and segments loaded from an
+// image refer into it rather than holding copies of their own.
+class file_image
+{
+    // [start, end) ranges of the image which are known to be all zeros,
+    // kept sorted
+    typedef std::pair<Elf64_Off, Elf64_Off> zero_range;
+
+  public:
+//------------------------------------------------------------------------------
+    // A lazy mapping does not read ahead: only the pages holding the
+    // headers are read at load time, and the contents of a section or
+    // segment are read when it is first asked for (see request()).
+    static std::shared_ptr<file_image>
+    map_file( const std::string& file_name, bool lazy = false )
+    {
+        int fd = ::open( file_name.c_str(), O_RDONLY );
+        if ( fd < 0 ) {
+            return 0;
+        }
+
+        std::shared_ptr<file_image> mapped = map_fd( fd, lazy );
+        ::close( fd );
+
+        return mapped;
+    }
+
+//------------------------------------------------------------------------------
+    // Read a whole file into a single buffer owned by the image.
+    static std::shared_ptr<file_image>
+    read_file( const std::string& file_name )
+    {
+        int fd = ::open( file_name.c_str(), O_RDONLY );
+        if ( fd < 0 ) {
+            return 0;
+        }
+
+        struct stat st;
+        size_t      size_hint = 0;
+        if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) ) {
+            size_hint = (size_t)st.st_size;
+        }
+
+        std::shared_ptr<file_image> buffer = drain( fd, size_hint );
+        ::close( fd );
+
+        return buffer;
+    }
+
+//------------------------------------------------------------------------------
+    // Take in everything readable from a descriptor which may not be
+    // seekable, such as stdin. A regular file (e.g. a shell redirect) is
+    // mapped; anything else is drained with large reads.
+    static std::shared_ptr<file_image>
+    read_fd( int fd, bool lazy = false )
+    {
+        struct stat st;
+        if ( fstat( fd, &st ) == 0 && S_ISREG( st.st_mode ) &&
+             lseek( fd, 0, SEEK_CUR ) == 0 ) {
+            return map_fd( fd, lazy );
+        }
+
+#ifdef F_SETPIPE_SZ
+        // Fewer, larger transfers from the writer at the other end.
+        if ( S_ISFIFO( st.st_mode ) ) {
+            fcntl( fd, F_SETPIPE_SZ, 1024 * 1024 );
+        }
+#endif
+
+        return drain( fd, 0 );
+    }
+
+//------------------------------------------------------------------------------
+    static std::shared_ptr<file_image>
+    read_stream( std::istream& stream )
+    {
+        std::shared_ptr<file_image> buffer( new file_image() );
+        while ( stream ) {
+            if ( buffer->size == buffer->capacity &&
+                 !buffer->grow( buffer->capacity * 2 ) ) {
+                return 0;
+            }
+
+            stream.read( buffer->base + buffer->size,
+                         buffer->capacity - buffer->size );
+            buffer->size += (size_t)stream.gcount();
+            stats::count( stats::get().bytes_read, stream.gcount() );
+        }
+
+        return buffer;
+    }
+
+//------------------------------------------------------------------------------
+    // A zero-filled image of exactly 'size' bytes, for assembling output.
+    static std::shared_ptr<file_image>
+    allocate( size_t size )
+    {
+        std::shared_ptr<file_image> buffer( new file_image() );
+        if ( !buffer->grow( size ) ) {
+            return 0;
+        }
+        buffer->size = size;
+
+        return buffer;
+    }
+
+//------------------------------------------------------------------------------
+    ~file_image()
+    {
+        if ( 0 != base ) {
+            munmap( base, capacity );
+        }
+    }
+
+    file_image( const file_image& ) = delete;
+    file_image& operator=( const file_image& ) = delete;
+
+//------------------------------------------------------------------------------
+    size_t
+    get_size() const
+    {
+        return size;
+    }
+
+//------------------------------------------------------------------------------
+    // Returns the bytes at [offset, offset + length), or 0 if the range
+    // does not lie within the image.
+    const char*
+    view( Elf64_Off offset, Elf_Xword length ) const
+    {
+        if ( offset > size || length > size - offset ) {
+            return 0;
+        }
+
+        return base + offset;
+    }
+
+//------------------------------------------------------------------------------
+    // As view(), but for modifying the image in place. Mapped files are
+    // mapped privately, so this never changes the file on disk. Returns 0
+    // for an image shared between elfio objects; the caller then needs a
+    // private copy of the bytes it wants to change.
+    char*
+    writable_view( Elf64_Off offset, Elf_Xword length )
+    {
+        if ( shared || 0 == view( offset, length ) ) {
+            return 0;
+        }
+
+        if ( !writable ) {
+            if ( 0 != mprotect( base, capacity, PROT_READ | PROT_WRITE ) ) {
+                return 0;
+            }
+            writable = true;
+        }
+
+        // Whatever is written here need not be zero any more, but the rest
+        // of a range it falls in still is: a few bytes patched into a hole
+        // mustn't make the whole hole get copied and written out.
+        std::vector<zero_range>::iterator first =
+            std::upper_bound( zero_ranges.begin(), zero_ranges.end(),
+                              zero_range( offset, offset ), ends_after );
+        std::vector<zero_range>::iterator last = first;
+        while ( last != zero_ranges.end() && last->first < offset + length ) {
+            ++last;
+        }
+        if ( first != last ) {
+            zero_range before( first->first, offset );
+            zero_range after( offset + length, ( last - 1 )->second );
+            first = zero_ranges.erase( first, last );
+            if ( after.first < after.second ) {
+                first = zero_ranges.insert( first, after );
+            }
+            if ( before.first < before.second ) {
+                zero_ranges.insert( first, before );
+            }
+        }
+
+        return base + offset;
+    }
+
+//------------------------------------------------------------------------------
+    bool
+    write_at( Elf64_Off offset, const char* bytes, Elf_Xword length )
+    {
+        char* dest = writable_view( offset, length );
+        if ( 0 == dest ) {
+            return false;
+        }
+
+        std::copy( bytes, bytes + length, dest );
+        return true;
+    }
+
+//------------------------------------------------------------------------------
+    // Copy [offset, offset + length) of this image into dest at dest_offset.
+    // Ranges which are holes in a sparse input file are not read; they are
+    // recorded in dest as known to be zero instead, so that they can stay
+    // holes when dest is written out.
+    bool
+    copy_to( file_image& dest, Elf64_Off dest_offset,
+             Elf64_Off offset, Elf_Xword length ) const
+    {
+        const char* src = view( offset, length );
+        char*       out = dest.writable_view( dest_offset, length );
+        if ( 0 == src || 0 == out ) {
+            return false;
+        }
+
+        Elf64_Off pos = offset;
+        Elf64_Off end = offset + length;
+        std::vector<zero_range>::const_iterator hole =
+            std::upper_bound( zero_ranges.begin(), zero_ranges.end(),
+                              zero_range( pos, pos ), ends_after );
+        for ( ; hole != zero_ranges.end() && hole->first < end; ++hole ) {
+            Elf64_Off hole_start = std::max( hole->first, pos );
+            Elf64_Off hole_end   = std::min( hole->second, end );
+
+            std::copy( base + pos, base + hole_start, out + ( pos - offset ) );
+            dest.add_zero_range( dest_offset + ( hole_start - offset ),
+                                 dest_offset + ( hole_end - offset ) );
+            pos = hole_end;
+        }
+        std::copy( base + pos, base + end, out + ( pos - offset ) );
+
+        return true;
+    }
+
+//------------------------------------------------------------------------------
+    // Write the whole image to a descriptor. A regular file is written
+    // sparsely; when it is a pipe the pages are handed over with vmsplice()
+    // rather than copied.
+    bool
+    write_fd( int fd ) const
+    {
+        const char* next      = base;
+        size_t      remaining = size;
+
+        struct stat st;
+        bool        have_stat = fstat( fd, &st ) == 0;
+        if ( have_stat && S_ISREG( st.st_mode ) &&
+             !( fcntl( fd, F_GETFL ) & O_APPEND ) ) {
+            return write_sparse( fd );
+        }
+
+#ifdef SPLICE_F_NONBLOCK
+        bool is_pipe = have_stat && S_ISFIFO( st.st_mode );
+#ifdef F_SETPIPE_SZ
+        if ( is_pipe ) {
+            fcntl( fd, F_SETPIPE_SZ, 1024 * 1024 );
+        }
+#endif
+        while ( is_pipe && remaining > 0 ) {
+            struct iovec iov;
+            iov.iov_base = const_cast<char*>( next );
+            iov.iov_len  = remaining;
+
+            ssize_t done = vmsplice( fd, &iov, 1, 0 );
+            if ( done < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( done < 0 ) {
+                // Not supported here; fall back to plain writes.
+                break;
+            }
+            next      += done;
+            remaining -= (size_t)done;
+            stats::count( stats::get().bytes_written, done );
+        }
+#endif
+
+        while ( remaining > 0 ) {
+            ssize_t done = ::write( fd, next, remaining );
+            if ( done < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( done <= 0 ) {
+                return false;
+            }
+            next      += done;
+            remaining -= (size_t)done;
+            stats::count( stats::get().bytes_written, done );
+        }
+
+        return true;
+    }
+
+//------------------------------------------------------------------------------
+    // Once sections of more than one elfio refer to this image, none of them
+    // may modify it in place.
+    void
+    mark_shared()
+    {
+        shared = true;
+    }
+
+//------------------------------------------------------------------------------
+    // Called the first time a section or segment's bytes are wanted. For
+    // lazy images this starts streaming that range in; otherwise the
+    // whole image is already resident or on its way.
+    void
+    request( Elf64_Off offset, Elf_Xword length ) const
+    {
+        if ( !lazy || 0 == view( offset, length ) || 0 == length ) {
+            return;
+        }
+
+        size_t page  = (size_t)sysconf( _SC_PAGESIZE );
+        size_t start = (size_t)offset & ~( page - 1 );
+        size_t end   = (size_t)( offset + length );
+        madvise( base + start, end - start, MADV_SEQUENTIAL );
+        madvise( base + start, end - start, MADV_WILLNEED );
+        stats::count( stats::get().bytes_read, length );
+    }
+
+//------------------------------------------------------------------------------
+  private:
+    file_image() :
+        base( 0 ), size( 0 ), capacity( 0 ), lazy( false ), writable( true ),
+        shared( false )
+    {
+    }
+
+    file_image( char* base_, size_t size_, bool lazy_ ) :
+        base( base_ ), size( size_ ), capacity( size_ ), lazy( lazy_ ),
+        writable( false ), shared( false )
+    {
+    }
+
+//------------------------------------------------------------------------------
+    static std::shared_ptr<file_image>
+    map_fd( int fd, bool lazy = false )
+    {
+        struct stat st;
+        if ( fstat( fd, &st ) != 0 || !S_ISREG( st.st_mode ) || st.st_size == 0 ) {
+            return 0;
+        }
+
+        size_t size = (size_t)st.st_size;
+        void*  base = mmap( 0, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+        if ( MAP_FAILED == base ) {
+            return 0;
+        }
+
+        std::shared_ptr<file_image> mapped(
+            new file_image( static_cast<char*>( base ), size, lazy ) );
+
+        // Remember where a sparse file's holes are (it has fewer blocks
+        // allocated than its size needs).
+        if ( (size_t)st.st_blocks * 512 < size ) {
+            mapped->find_holes( fd );
+        }
+
+        if ( lazy ) {
+            madvise( base, size, MADV_RANDOM );
+        }
+        else {
+            // The parser walks the file front to back, so ask for
+            // aggressive read-ahead and start it now.
+            madvise( base, size, MADV_SEQUENTIAL );
+            madvise( base, size, MADV_WILLNEED );
+            stats::count( stats::get().bytes_read, size );
+        }
+
+        return mapped;
+    }
+
+//------------------------------------------------------------------------------
+    void
+    find_holes( int fd )
+    {
+#ifdef SEEK_HOLE
+        off_t pos = 0;
+        while ( (size_t)pos < size ) {
+            off_t data = lseek( fd, pos, SEEK_DATA );
+            if ( data < 0 ) {
+                data = (off_t)size;     // ENXIO: a hole up to the end
+            }
+            if ( data > pos ) {
+                zero_ranges.push_back( zero_range( pos, data ) );
+            }
+            if ( (size_t)data >= size ) {
+                break;
+            }
+
+            pos = lseek( fd, data, SEEK_HOLE );
+            if ( pos < 0 ) {
+                break;
+            }
+        }
+#endif
+    }
+
+//------------------------------------------------------------------------------
+    // Write to a regular file, leaving holes where the image has whole
+    // blocks of zeros: alignment padding, zero-filled sections and holes
+    // carried over from sparse inputs.
+    bool
+    write_sparse( int fd ) const
+    {
+        off_t start = lseek( fd, 0, SEEK_CUR );
+        if ( start < 0 || 0 != ftruncate( fd, start ) ) {
+            return false;
+        }
+
+        std::vector<zero_range>::const_iterator known = zero_ranges.begin();
+
+        size_t block   = (size_t)sysconf( _SC_PAGESIZE );
+        size_t pos     = 0;
+        size_t pending = 0;     // Start of the data not yet written
+        while ( pos < size ) {
+            // Blocks are aligned to the file, not to the image
+            size_t length = std::min( block - ( start + pos ) % block, size - pos );
+
+            while ( known != zero_ranges.end() && known->second <= pos ) {
+                ++known;
+            }
+            bool in_known = known != zero_ranges.end() &&
+                            known->first <= pos && pos + length <= known->second;
+
+            if ( length == block && ( in_known || is_zero( base + pos, length ) ) ) {
+                if ( !pwrite_all( fd, base + pending, pos - pending, start + pending ) ) {
+                    return false;
+                }
+                pending = pos + length;
+            }
+            pos += length;
+        }
+
+        if ( !pwrite_all( fd, base + pending, size - pending, start + pending ) ) {
+            return false;
+        }
+
+        // Extend the file over a trailing hole, and leave the file position
+        // after the image as a plain write() would have.
+        return 0 == ftruncate( fd, start + size ) &&
+               lseek( fd, start + size, SEEK_SET ) >= 0;
+    }
+
+//------------------------------------------------------------------------------
+    static bool
+    pwrite_all( int fd, const char* bytes, size_t length, off_t offset )
+    {
+        while ( length > 0 ) {
+            ssize_t done = pwrite( fd, bytes, length, offset );
+            if ( done < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( done <= 0 ) {
+                return false;
+            }
+            bytes  += done;
+            length -= (size_t)done;
+            offset += done;
+            stats::count( stats::get().bytes_written, done );
+        }
+
+        return true;
+    }
+
+//------------------------------------------------------------------------------
+    // Comparing the block with itself shifted by one byte lets memcmp, which
+    // the C library vectorizes, do the scan.
+    static bool
+    is_zero( const char* bytes, size_t length )
+    {
+        return 0 == bytes[0] && 0 == std::memcmp( bytes, bytes + 1, length - 1 );
+    }
+
+//------------------------------------------------------------------------------
+    // For upper_bound: finds the first range which ends after the offset
+    // given as 'offset.first'.
+    static bool
+    ends_after( const zero_range& offset, const zero_range& range )
+    {
+        return offset.first < range.second;
+    }
+
+//------------------------------------------------------------------------------
+    void
+    add_zero_range( Elf64_Off start, Elf64_Off end )
+    {
+        zero_ranges.insert(
+            std::upper_bound( zero_ranges.begin(), zero_ranges.end(),
+                              zero_range( start, start ), ends_after ),
+            zero_range( start, end ) );
+    }
+
+//------------------------------------------------------------------------------
+    // Read until end of file into a buffer which starts out large enough
+    // for size_hint bytes and grows as needed.
+    static std::shared_ptr<file_image>
+    drain( int fd, size_t size_hint )
+    {
+        std::shared_ptr<file_image> buffer( new file_image() );
+        if ( !buffer->grow( size_hint + 1 ) ) {
+            return 0;
+        }
+
+        for ( ;; ) {
+            if ( buffer->size == buffer->capacity &&
+                 !buffer->grow( buffer->capacity * 2 ) ) {
+                return 0;
+            }
+
+            ssize_t got = ::read( fd, buffer->base + buffer->size,
+                                  buffer->capacity - buffer->size );
+            if ( got < 0 && errno == EINTR ) {
+                continue;
+            }
+            if ( got < 0 ) {
+                return 0;
+            }
+            if ( got == 0 ) {
+                break;
+            }
+            buffer->size += (size_t)got;
+            stats::count( stats::get().bytes_read, got );
+        }
+
+        return buffer;
+    }
+
+//------------------------------------------------------------------------------
+    // Enlarge a buffer being filled by drain/read_stream. The buffer is an
+    // anonymous mapping, so it stays page-aligned and can usually be grown
+    // without copying. It isn't reserved against swap: an output image can
+    // be far larger than memory when most of it is zero-filled sections,
+    // whose pages are never touched.
+    bool
+    grow( size_t new_capacity )
+    {
+        size_t page = (size_t)sysconf( _SC_PAGESIZE );
+        new_capacity = std::max( new_capacity, (size_t)1024 * 1024 );
+        new_capacity = ( new_capacity + page - 1 ) & ~( page - 1 );
+
+        void* new_base;
+
+        if ( 0 == base ) {
+            new_base = mmap( 0, new_capacity, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+        }
+        else {
+#ifdef MREMAP_MAYMOVE
+            new_base = mremap( base, capacity, new_capacity, MREMAP_MAYMOVE );
+#else
+            new_base = mmap( 0, new_capacity, PROT_READ | PROT_WRITE,
+                             MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0 );
+            if ( MAP_FAILED != new_base ) {
+                std::copy( base, base + size, static_cast<char*>( new_base ) );
+                munmap( base, capacity );
+            }
+#endif
+        }
+
+        if ( MAP_FAILED == new_base ) {
+            return false;
+        }
+
+        base     = static_cast<char*>( new_base );
+        capacity = new_capacity;
+        return true;
+    }
+
+//------------------------------------------------------------------------------
+  private:
+    char*  base;
+    size_t size;
+    size_t capacity;
+    bool   lazy;
+    bool   writable;
+    bool   shared;
+    std::vector<zero_range> zero_ranges;
+};
+
+} // namespace ELFIO
+
+#endif // ELFIO_IMAGE_HPP
@@ -0,0 +1,205 @@
+/*
+Copyright (C) 2001-2015 by Serge Lamikhov-Center
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+#ifndef ELFIO_INDEX_HPP
+#define ELFIO_INDEX_HPP
+
+#include <vector>
+#include <algorithm>
+
+namespace ELFIO {
+
+//------------------------------------------------------------------------------
+// Address ranges of sections or segments, for finding the item of a given
+// kind (its type) which contains an address. The ranges may overlap, so
+// build() splits each kind's address space into non-overlapping pieces, each
+// holding the item a lookup in it would find, and a lookup is then a binary
+// search however many ranges overlap.
+template< class T >
+class address_index
+{
+  public:
+//------------------------------------------------------------------------------
+    void
+    clear()
+    {
+        ranges.clear();
+        pieces.clear();
+    }
+
+//------------------------------------------------------------------------------
+    // 'order' decides between several items containing the same address
+    void
+    add( Elf64_Addr start, Elf_Xword length, T* item, size_t order,
+         Elf_Word key )
+    {
+        if ( 0 == length ) {
+            return;
+        }
+
+        range r;
+        r.key   = key;
+        r.start = start;
+        r.end   = start + length < start ? ~(Elf64_Addr)0 : start + length;
+        r.item  = item;
+        r.order = order;
+        ranges.push_back( r );
+    }
+
+//------------------------------------------------------------------------------
+    // Called once all ranges have been added
+    void
+    build()
+    {
+        std::sort( ranges.begin(), ranges.end() );
+
+        pieces.clear();
+        for ( size_t first = 0; first < ranges.size(); ) {
+            size_t last = first;
+            while ( last < ranges.size() && ranges[last].key == ranges[first].key ) {
+                ++last;
+            }
+            build_key( first, last );
+            first = last;
+        }
+
+        ranges.clear();
+    }
+
+//------------------------------------------------------------------------------
+    // The lowest-ordered item of kind 'key' whose range contains 'address',
+    // or 0
+    T*
+    find( Elf64_Addr address, Elf_Word key ) const
+    {
+        piece p;
+        p.key   = key;
+        p.start = address;
+        typename std::vector<piece>::const_iterator it =
+            std::upper_bound( pieces.begin(), pieces.end(), p );
+        if ( it == pieces.begin() ) {
+            return 0;
+        }
+
+        --it;
+        if ( it->key != key || it->end <= address ) {
+            return 0;
+        }
+
+        return it->item;
+    }
+
+//------------------------------------------------------------------------------
+  private:
+    struct range
+    {
+        Elf_Word   key;
+        Elf64_Addr start;
+        Elf64_Addr end;
+        T*         item;
+        size_t     order;
+
+        bool
+        operator<( const range& rhs ) const
+        {
+            return key < rhs.key || ( key == rhs.key && start < rhs.start );
+        }
+    };
+
+    struct piece
+    {
+        Elf_Word   key;
+        Elf64_Addr start;
+        Elf64_Addr end;
+        T*         item;
+
+        bool
+        operator<( const piece& rhs ) const
+        {
+            return key < rhs.key || ( key == rhs.key && start < rhs.start );
+        }
+    };
+
+    // Orders a heap of ranges with the lowest order on top
+    static bool
+    later_order( const range* a, const range* b )
+    {
+        return a->order > b->order;
+    }
+
+//------------------------------------------------------------------------------
+    // Sweeps over the starts and ends of ranges [first, last), which are of
+    // one kind and sorted by start. Between each boundary and the next, the
+    // ranges covering the addresses are the same, and the piece belongs to
+    // the lowest-ordered of them: the top of a heap of the ranges started so
+    // far, once those which have ended are popped off it.
+    void
+    build_key( size_t first, size_t last )
+    {
+        std::vector<Elf64_Addr> bounds;
+        for ( size_t i = first; i < last; ++i ) {
+            bounds.push_back( ranges[i].start );
+            bounds.push_back( ranges[i].end );
+        }
+        std::sort( bounds.begin(), bounds.end() );
+        bounds.erase( std::unique( bounds.begin(), bounds.end() ), bounds.end() );
+
+        std::vector<const range*> active;
+        size_t next = first;
+        for ( size_t b = 0; b + 1 < bounds.size(); ++b ) {
+            while ( next < last && ranges[next].start == bounds[b] ) {
+                active.push_back( &ranges[next++] );
+                std::push_heap( active.begin(), active.end(), later_order );
+            }
+            // Ranges which ended below the top one stay until they come up
+            while ( !active.empty() && active.front()->end <= bounds[b] ) {
+                std::pop_heap( active.begin(), active.end(), later_order );
+                active.pop_back();
+            }
+            if ( active.empty() ) {
+                continue;
+            }
+
+            T* item = active.front()->item;
+            if ( !pieces.empty() && pieces.back().key == ranges[first].key &&
+                 pieces.back().end == bounds[b] && pieces.back().item == item ) {
+                pieces.back().end = bounds[b + 1];
+                continue;
+            }
+
+            piece p;
+            p.key   = ranges[first].key;
+            p.start = bounds[b];
+            p.end   = bounds[b + 1];
+            p.item  = item;
+            pieces.push_back( p );
+        }
+    }
+
+//------------------------------------------------------------------------------
+    std::vector<range> ranges;
+    std::vector<piece> pieces;
+};
+
+} // namespace ELFIO
+
+#endif // ELFIO_INDEX_HPP
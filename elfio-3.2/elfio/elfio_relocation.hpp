@@ -276,10 +276,10 @@ class relocation_section_accessor
 //------------------------------------------------------------------------------
   private:
 //------------------------------------------------------------------------------
-    Elf_Half
+    Elf_Word
     get_symbol_table_index() const
     {
-        return (Elf_Half)relocation_section->get_link();
+        return (Elf_Word)relocation_section->get_link();
     }
 
 //------------------------------------------------------------------------------
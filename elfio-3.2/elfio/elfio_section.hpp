@@ -24,6 +24,7 @@ THE SOFTWARE.
 #define ELFIO_SECTION_HPP
 
 #include <string>
+#include <cstring>
 #include <iostream>
 
 namespace ELFIO {
@@ -37,7 +38,7 @@ class section
 	section() { }
 	section(const section &) = delete;
 
-    ELFIO_GET_ACCESS_DECL    ( Elf_Half,    index              );
+    ELFIO_GET_ACCESS_DECL    ( Elf_Word,    index              );
     ELFIO_GET_SET_ACCESS_DECL( std::string, name               );
     ELFIO_GET_SET_ACCESS_DECL( Elf_Word,    type               );
     ELFIO_GET_SET_ACCESS_DECL( Elf_Xword,   flags              );
@@ -50,21 +51,36 @@ class section
     ELFIO_GET_SET_ACCESS_DECL( Elf_Word,    name_string_offset );
 
     virtual const char* get_data() const                                = 0;
-    virtual void        set_data( const char* pData, Elf_Word size )    = 0;
-    virtual void        set_data( const std::string& data )             = 0;
-    virtual void        append_data( const char* pData, Elf_Word size ) = 0;
-    virtual void        append_data( const std::string& data )          = 0;
+    virtual void        set_data( const char* pData, Elf_Xword size )    = 0;
+    virtual void        set_data( const std::string& data )              = 0;
+    virtual void        append_data( const char* pData, Elf_Xword size ) = 0;
+    virtual void        append_data( const std::string& data )           = 0;
+    // Contents for modifying in place (get_size() bytes, 0 on failure)
+    virtual char*       get_mutable_data()                               = 0;
+    virtual bool        write_data( Elf_Xword offset, const char* pData,
+                                    Elf_Xword size )                     = 0;
 
   protected:
     ELFIO_GET_SET_ACCESS_DECL( Elf64_Off, offset );
-    ELFIO_SET_ACCESS_DECL( Elf_Half,  index  );
+    ELFIO_SET_ACCESS_DECL( Elf_Word,  index  );
     
-    virtual void load( std::istream&  f,
-                       std::streampos header_offset ) = 0;
-    virtual void save( std::ostream&  f,
-                       std::streampos header_offset,
-                       std::streampos data_offset )   = 0;
+    virtual void load( file_image&    image,
+                       Elf64_Off      header_offset ) = 0;
+    virtual void save( file_image&    f,
+                       Elf64_Off      header_offset,
+                       Elf64_Off      data_offset )   = 0;
+    // As save(), but without the section header
+    virtual void save_contents( file_image& f,
+                                Elf64_Off   data_offset ) = 0;
     virtual bool is_address_initialized() const       = 0;
+
+    // Where in a file image the section's contents are, if they are still
+    // in one (returns 0 otherwise)
+    virtual file_image* get_image( Elf64_Off& offset,
+                                   Elf_Xword& length ) const            = 0;
+    virtual void        set_image( file_image* image,
+                                   Elf64_Off   offset,
+                                   Elf_Xword   length )                 = 0;
 };
 
 
@@ -73,25 +89,32 @@ class section_impl : public section
 {
   public:
 //------------------------------------------------------------------------------
-    section_impl( const endianess_convertor convertor_ ) : convertor( convertor_ )
+    section_impl( const endianess_convertor convertor_,
+                  Elf_Xword* generation_, arena* pool_ ) :
+        convertor( convertor_ ), generation( generation_ ), pool( pool_ )
     {
         std::fill_n( reinterpret_cast<char*>( &header ), sizeof( header ), '\0' );
         is_address_set = false;
+        name           = "";
         data           = 0;
         data_size      = 0;
+        data_capacity  = 0;
+        image          = 0;
+        image_offset   = 0;
+        data_requested = false;
     }
 
 //------------------------------------------------------------------------------
     ~section_impl()
     {
-        delete [] data;
+        pool->release_buffer( data, data_capacity );
     }
 
 //------------------------------------------------------------------------------
     // Section info functions
-    ELFIO_GET_SET_ACCESS( Elf_Word,   type,               header.sh_type      );
-    ELFIO_GET_SET_ACCESS( Elf_Xword,  flags,              header.sh_flags     );
-    ELFIO_GET_SET_ACCESS( Elf_Xword,  size,               header.sh_size      );
+    ELFIO_GET_ACCESS    ( Elf_Word,   type,               header.sh_type      );
+    ELFIO_GET_ACCESS    ( Elf_Xword,  flags,              header.sh_flags     );
+    ELFIO_GET_ACCESS    ( Elf_Xword,  size,               header.sh_size      );
     ELFIO_GET_SET_ACCESS( Elf_Word,   link,               header.sh_link      );
     ELFIO_GET_SET_ACCESS( Elf_Word,   info,               header.sh_info      );
     ELFIO_GET_SET_ACCESS( Elf_Xword,  addr_align,         header.sh_addralign );
@@ -100,7 +123,34 @@ class section_impl : public section
     ELFIO_GET_ACCESS    ( Elf64_Addr, address,            header.sh_addr      );
 
 //------------------------------------------------------------------------------
-    Elf_Half
+    void
+    set_type( Elf_Word value )
+    {
+        header.sh_type = value;
+        header.sh_type = convertor( header.sh_type );
+        changed();
+    }
+
+//------------------------------------------------------------------------------
+    void
+    set_flags( Elf_Xword value )
+    {
+        header.sh_flags = value;
+        header.sh_flags = convertor( header.sh_flags );
+        changed();
+    }
+
+//------------------------------------------------------------------------------
+    void
+    set_size( Elf_Xword value )
+    {
+        header.sh_size = value;
+        header.sh_size = convertor( header.sh_size );
+        changed();
+    }
+
+//------------------------------------------------------------------------------
+    Elf_Word
     get_index() const
     {
         return index;
@@ -118,7 +168,8 @@ class section_impl : public section
     void
     set_name( std::string name_ )
     {
-        name = name_;
+        name = pool->copy_string( name_ );
+        changed();
     }
 
 //------------------------------------------------------------------------------
@@ -128,6 +179,7 @@ class section_impl : public section
         header.sh_addr = value;
         header.sh_addr = convertor( header.sh_addr );
         is_address_set = true;
+        changed();
     }
 
 //------------------------------------------------------------------------------
@@ -141,17 +193,40 @@ class section_impl : public section
     const char*
     get_data() const
     {
+        if ( 0 != image ) {
+            if ( !data_requested ) {
+                image->request( image_offset, data_size );
+                data_requested = true;
+            }
+            return image->view( image_offset, data_size );
+        }
+
         return data;
     }
 
 //------------------------------------------------------------------------------
     void
-    set_data( const char* raw_data, Elf_Word size )
+    set_data( const char* raw_data, Elf_Xword size )
     {
+        if ( 0 != image && 0 != raw_data && size == data_size ) {
+            // Same size: overwrite the contents in the file image, so that
+            // the segments covering this section see the change too.
+            char* in_place = image->writable_view( image_offset, data_size );
+            if ( 0 != in_place ) {
+                if ( in_place != raw_data ) {
+                    std::memmove( in_place, raw_data, size );
+                }
+                return;
+            }
+        }
+
         if ( get_type() != SHT_NOBITS ) {
-            delete [] data;
+            release_data();
+            image = 0;
             try {
-                data = new char[size];
+                data          = pool->allocate_buffer( size );
+                data_capacity = size;
+                stats::count( stats::get().buffers );
             } catch (const std::bad_alloc&) {
                 data      = 0;
                 data_size = 0;
@@ -170,22 +245,46 @@ class section_impl : public section
     void
     set_data( const std::string& str_data )
     {
-        return set_data( str_data.c_str(), (Elf_Word)str_data.size() );
+        return set_data( str_data.c_str(), (Elf_Xword)str_data.size() );
     }
 
 //------------------------------------------------------------------------------
     void
-    append_data( const char* raw_data, Elf_Word size )
+    append_data( const char* raw_data, Elf_Xword size )
     {
         if ( get_type() != SHT_NOBITS ) {
-            if ( get_size() + size < data_size ) {
+            if ( 0 != image ) {
+                // Appending to a section which still refers into the file
+                // image: take a private copy first.
+                const char* viewed = get_data();
+                data_size = 2*( data_size + size );
+                release_data();
+                try {
+                    data          = pool->allocate_buffer( data_size );
+                    data_capacity = data_size;
+                    stats::count( stats::get().buffers );
+                } catch (const std::bad_alloc&) {
+                    data      = 0;
+                    data_size = 0;
+                    size      = 0;
+                }
+                if ( 0 != data ) {
+                    if ( 0 != viewed ) {
+                        std::copy( viewed, viewed + get_size(), data );
+                    }
+                    std::copy( raw_data, raw_data + size, data + get_size() );
+                }
+                image = 0;
+            }
+            else if ( get_size() + size < data_size ) {
                 std::copy( raw_data, raw_data + size, data + get_size() );
             }
             else {
                 data_size = 2*( data_size + size);
                 char* new_data;
                 try {
-                    new_data = new char[data_size];
+                    new_data = pool->allocate_buffer( data_size );
+                    stats::count( stats::get().buffers );
                 } catch (const std::bad_alloc&) {
                     new_data = 0;
                     size     = 0;
@@ -193,8 +292,9 @@ class section_impl : public section
                 if ( 0 != new_data ) {
                     std::copy( data, data + get_size(), new_data );
                     std::copy( raw_data, raw_data + size, new_data + get_size() );
-                    delete [] data;
-                    data = new_data;
+                    release_data();
+                    data          = new_data;
+                    data_capacity = data_size;
                 }
             }
             set_size( get_size() + size );
@@ -205,7 +305,76 @@ class section_impl : public section
     void
     append_data( const std::string& str_data )
     {
-        return append_data( str_data.c_str(), (Elf_Word)str_data.size() );
+        return append_data( str_data.c_str(), (Elf_Xword)str_data.size() );
+    }
+
+//------------------------------------------------------------------------------
+    char*
+    get_mutable_data()
+    {
+        if ( get_type() == SHT_NOBITS ) {
+            return 0;
+        }
+
+        Elf_Xword size = get_size();
+        if ( 0 != image && data_size >= size ) {
+            char* in_place = image->writable_view( image_offset, size );
+            if ( 0 != in_place ) {
+                return in_place;
+            }
+        }
+
+        if ( 0 != image || data_size < size ) {
+            // The image can't be written (e.g. it is shared with another
+            // elfio), or the data doesn't cover the whole section: take a
+            // private copy, zero-filled past the end of the old data.
+            const char* old_data = get_data();
+            char*       copy;
+            try {
+                copy = pool->allocate_buffer( size );
+                stats::count( stats::get().buffers );
+            } catch (const std::bad_alloc&) {
+                return 0;
+            }
+            Elf_Xword kept = 0;
+            if ( 0 != old_data ) {
+                kept = std::min( size, data_size );
+                std::copy( old_data, old_data + kept, copy );
+            }
+            std::fill( copy + kept, copy + size, '\0' );
+            release_data();
+            data          = copy;
+            data_size     = size;
+            data_capacity = size;
+            image         = 0;
+        }
+
+        return data;
+    }
+
+//------------------------------------------------------------------------------
+    // Overwrites part of the contents. Where they are still in a file image
+    // that can be written, only those bytes are written there, so the rest
+    // of a large section is neither copied nor read.
+    bool
+    write_data( Elf_Xword offset, const char* raw_data, Elf_Xword size )
+    {
+        if ( offset > get_size() || size > get_size() - offset ) {
+            return false;
+        }
+
+        if ( 0 != image && offset + size <= data_size &&
+             image->write_at( image_offset + offset, raw_data, size ) ) {
+            return true;
+        }
+
+        char* contents = get_mutable_data();
+        if ( 0 == contents ) {
+            return false;
+        }
+        std::copy( raw_data, raw_data + size, contents + offset );
+
+        return true;
     }
 
 //------------------------------------------------------------------------------
@@ -215,41 +384,58 @@ class section_impl : public section
 
 //------------------------------------------------------------------------------
     void
-    set_index( Elf_Half value )
+    set_index( Elf_Word value )
     {
         index = value;
     }
 
 //------------------------------------------------------------------------------
     void
-    load( std::istream&  stream,
-          std::streampos header_offset )
+    load( file_image& image_,
+          Elf64_Off   header_offset )
     {
         std::fill_n( reinterpret_cast<char*>( &header ), sizeof( header ), '\0' );
-        stream.seekg( header_offset );
-        stream.read( reinterpret_cast<char*>( &header ), sizeof( header ) );
+        const char* raw = image_.view( header_offset, sizeof( header ) );
+        if ( 0 != raw ) {
+            std::copy( raw, raw + sizeof( header ), reinterpret_cast<char*>( &header ) );
+        }
 
+        // Refer to the section contents in place; they are only copied if
+        // the section is later modified.
         Elf_Xword size = get_size();
-        if ( 0 == data && SHT_NULL != get_type() && SHT_NOBITS != get_type() ) {
-            try {
-                data = new char[size];
-            } catch (const std::bad_alloc&) {
-                data      = 0;
-                data_size = 0;
-            }
-            if ( 0 != size ) {
-                stream.seekg( convertor( header.sh_offset ) );
-                stream.read( data, size );
-                data_size = size;
-            }
+        if ( 0 == data && SHT_NULL != get_type() && SHT_NOBITS != get_type() &&
+             0 != size ) {
+            image        = &image_;
+            image_offset = convertor( header.sh_offset );
+            data_size    = size;
         }
     }
 
+//------------------------------------------------------------------------------
+    file_image*
+    get_image( Elf64_Off& offset, Elf_Xword& length ) const
+    {
+        offset = image_offset;
+        length = data_size;
+        return image;
+    }
+
 //------------------------------------------------------------------------------
     void
-    save( std::ostream&  f,
-          std::streampos header_offset,
-          std::streampos data_offset )
+    set_image( file_image* image_, Elf64_Off offset, Elf_Xword length )
+    {
+        release_data();
+        image          = image_;
+        image_offset   = offset;
+        data_size      = length;
+        data_requested = false;
+    }
+
+//------------------------------------------------------------------------------
+    void
+    save( file_image& f,
+          Elf64_Off   header_offset,
+          Elf64_Off   data_offset )
     {
         if ( 0 != get_index() ) {
             header.sh_offset = data_offset;
@@ -257,40 +443,82 @@ class section_impl : public section
         }
 
         save_header( f, header_offset );
+        save_contents( f, data_offset );
+    }
+
+//------------------------------------------------------------------------------
+    void
+    save_contents( file_image& f,
+                   Elf64_Off   data_offset )
+    {
         if ( get_type() != SHT_NOBITS && get_type() != SHT_NULL &&
-             get_size() != 0 && data != 0 ) {
+             get_size() != 0 && get_data() != 0 ) {
             save_data( f, data_offset );
         }
     }
 
 //------------------------------------------------------------------------------
   private:
+//------------------------------------------------------------------------------
+    // Lets the owning elfio know that its index is out of date
+    void
+    changed()
+    {
+        if ( 0 != generation ) {
+            ++*generation;
+        }
+    }
+
 //------------------------------------------------------------------------------
     void
-    save_header( std::ostream&  f,
-                 std::streampos header_offset ) const
+    release_data()
     {
-        f.seekp( header_offset );
-        f.write( reinterpret_cast<const char*>( &header ), sizeof( header ) );
+        pool->release_buffer( data, data_capacity );
+        data          = 0;
+        data_capacity = 0;
     }
 
 //------------------------------------------------------------------------------
     void
-    save_data( std::ostream&  f,
-               std::streampos data_offset ) const
+    save_header( file_image& f,
+                 Elf64_Off   header_offset ) const
     {
-        f.seekp( data_offset );
-        f.write( get_data(), get_size() );
+        f.write_at( header_offset, reinterpret_cast<const char*>( &header ),
+                    sizeof( header ) );
+    }
+
+//------------------------------------------------------------------------------
+    void
+    save_data( file_image& f,
+               Elf64_Off   data_offset ) const
+    {
+        // The section may be larger than its data (e.g. a PROGBITS section
+        // whose size has been extended to cover trailing bss); the rest of
+        // its file space is left zero-filled.
+        Elf_Xword length = std::min( get_size(), data_size );
+        if ( 0 != image ) {
+            // Lets holes in a sparse input stay holes in the output
+            image->copy_to( f, data_offset, image_offset, length );
+        }
+        else {
+            f.write_at( data_offset, get_data(), length );
+        }
     }
 
 //------------------------------------------------------------------------------
   private:
     T                          header;
-    Elf_Half                   index;
-    std::string                name;
+    Elf_Word                   index;
+    const char*                name;      // In the pool
     char*                      data;
-    Elf_Word                   data_size;
+    Elf_Xword                  data_size;
+    Elf_Xword                  data_capacity;  // As allocated from the pool
+    file_image*                image;
+    Elf64_Off                  image_offset;
+    mutable bool               data_requested;
     const endianess_convertor convertor;
+    Elf_Xword*                 generation;
+    arena*                     pool;
     bool                       is_address_set;
 };
 
@@ -46,19 +46,24 @@ class segment
 
     virtual const char* get_data() const = 0;
 
-    virtual Elf_Half add_section_index( Elf_Half index, Elf_Xword addr_align ) = 0;
-    virtual Elf_Half get_sections_num()                                  const = 0;
-    virtual Elf_Half get_section_index_at( Elf_Half num )                const = 0;
+    virtual Elf_Word add_section_index( Elf_Word index, Elf_Xword addr_align ) = 0;
+    virtual Elf_Word get_sections_num()                                  const = 0;
+    virtual Elf_Word get_section_index_at( Elf_Word num )                const = 0;
     virtual bool is_offset_initialized()                                 const = 0;
 
   protected:
     ELFIO_SET_ACCESS_DECL( Elf64_Off, offset );
     ELFIO_SET_ACCESS_DECL( Elf_Half,  index  );
     
-    virtual const std::vector<Elf_Half>& get_sections() const               = 0;
-    virtual void load( std::istream& stream, std::streampos header_offset ) = 0;
-    virtual void save( std::ostream& f,      std::streampos header_offset,
-                                             std::streampos data_offset )   = 0;
+    virtual const std::vector<Elf_Word>& get_sections() const               = 0;
+    virtual void load( file_image& image, Elf64_Off header_offset )         = 0;
+    virtual void save( file_image& f,        Elf64_Off header_offset,
+                                             Elf64_Off data_offset )        = 0;
+
+    // Where in a file image the segment's contents are, if it was loaded
+    // from one (returns 0 otherwise)
+    virtual file_image* get_image( Elf64_Off& offset,
+                                   Elf_Xword& length ) const                = 0;
 };
 
 
@@ -68,12 +73,16 @@ class segment_impl : public segment
 {
   public:
 //------------------------------------------------------------------------------
-    segment_impl( endianess_convertor convertor_ ) :
-        convertor( convertor_ )
+    segment_impl( endianess_convertor convertor_, Elf_Xword* generation_ ) :
+        convertor( convertor_ ), generation( generation_ )
     {
         is_offset_set = false;
         std::fill_n( reinterpret_cast<char*>( &ph ), sizeof( ph ), '\0' );
-        data = 0;
+        data           = 0;
+        image          = 0;
+        image_offset   = 0;
+        image_size     = 0;
+        data_requested = false;
     }
 
 //------------------------------------------------------------------------------
@@ -84,15 +93,44 @@ class segment_impl : public segment
 
 //------------------------------------------------------------------------------
     // Section info functions
-    ELFIO_GET_SET_ACCESS( Elf_Word,   type,             ph.p_type   );
+    ELFIO_GET_ACCESS    ( Elf_Word,   type,             ph.p_type   );
     ELFIO_GET_SET_ACCESS( Elf_Word,   flags,            ph.p_flags  );
     ELFIO_GET_SET_ACCESS( Elf_Xword,  align,            ph.p_align  );
-    ELFIO_GET_SET_ACCESS( Elf64_Addr, virtual_address,  ph.p_vaddr  );
+    ELFIO_GET_ACCESS    ( Elf64_Addr, virtual_address,  ph.p_vaddr  );
     ELFIO_GET_SET_ACCESS( Elf64_Addr, physical_address, ph.p_paddr  );
     ELFIO_GET_SET_ACCESS( Elf_Xword,  file_size,        ph.p_filesz );
-    ELFIO_GET_SET_ACCESS( Elf_Xword,  memory_size,      ph.p_memsz  );
+    ELFIO_GET_ACCESS    ( Elf_Xword,  memory_size,      ph.p_memsz  );
     ELFIO_GET_ACCESS( Elf64_Off, offset, ph.p_offset );
 
+//------------------------------------------------------------------------------
+    // These change the segment's address range, so invalidate the owning
+    // elfio's index
+    void
+    set_type( Elf_Word value )
+    {
+        ph.p_type = value;
+        ph.p_type = convertor( ph.p_type );
+        changed();
+    }
+
+//------------------------------------------------------------------------------
+    void
+    set_virtual_address( Elf64_Addr value )
+    {
+        ph.p_vaddr = value;
+        ph.p_vaddr = convertor( ph.p_vaddr );
+        changed();
+    }
+
+//------------------------------------------------------------------------------
+    void
+    set_memory_size( Elf_Xword value )
+    {
+        ph.p_memsz = value;
+        ph.p_memsz = convertor( ph.p_memsz );
+        changed();
+    }
+
 //------------------------------------------------------------------------------
     Elf_Half
     get_index() const
@@ -104,31 +142,39 @@ class segment_impl : public segment
     const char*
     get_data() const
     {
+        if ( 0 != image ) {
+            if ( !data_requested ) {
+                image->request( image_offset, image_size );
+                data_requested = true;
+            }
+            return image->view( image_offset, image_size );
+        }
+
         return data;
     }
 
 //------------------------------------------------------------------------------
-    Elf_Half
-    add_section_index( Elf_Half sec_index, Elf_Xword addr_align )
+    Elf_Word
+    add_section_index( Elf_Word sec_index, Elf_Xword addr_align )
     {
         sections.push_back( sec_index );
         if ( addr_align > get_align() ) {
             set_align( addr_align );
         }
 
-        return (Elf_Half)sections.size();
+        return (Elf_Word)sections.size();
     }
 
 //------------------------------------------------------------------------------
-    Elf_Half
+    Elf_Word
     get_sections_num() const
     {
-        return (Elf_Half)sections.size();
+        return (Elf_Word)sections.size();
     }
 
 //------------------------------------------------------------------------------
-    Elf_Half
-    get_section_index_at( Elf_Half num ) const
+    Elf_Word
+    get_section_index_at( Elf_Word num ) const
     {
         if ( num < sections.size() ) {
             return sections[num];
@@ -158,7 +204,16 @@ class segment_impl : public segment
     }
 
 //------------------------------------------------------------------------------
-    const std::vector<Elf_Half>&
+    file_image*
+    get_image( Elf64_Off& offset, Elf_Xword& length ) const
+    {
+        offset = image_offset;
+        length = image_size;
+        return image;
+    }
+
+//------------------------------------------------------------------------------
+    const std::vector<Elf_Word>&
     get_sections() const
     {
         return sections;
@@ -173,45 +228,55 @@ class segment_impl : public segment
 
 //------------------------------------------------------------------------------
     void
-    load( std::istream&  stream,
-          std::streampos header_offset )
+    load( file_image& image_,
+          Elf64_Off   header_offset )
     {
-        stream.seekg( header_offset );
-        stream.read( reinterpret_cast<char*>( &ph ), sizeof( ph ) );
+        const char* raw = image_.view( header_offset, sizeof( ph ) );
+        if ( 0 != raw ) {
+            std::copy( raw, raw + sizeof( ph ), reinterpret_cast<char*>( &ph ) );
+        }
         is_offset_set = true;
 
         if ( PT_NULL != get_type() && 0 != get_file_size() ) {
-            stream.seekg( convertor( ph.p_offset ) );
-            Elf_Xword size = get_file_size();
-            try {
-                data = new char[size];
-            } catch (const std::bad_alloc&) {
-                data = 0;
-            }
-            if ( 0 != data ) {
-                stream.read( data, size );
-            }
+            image        = &image_;
+            image_offset = convertor( ph.p_offset );
+            image_size   = get_file_size();
         }
     }
 
 //------------------------------------------------------------------------------
-    void save( std::ostream&  f,
-               std::streampos header_offset,
-               std::streampos data_offset )
+    void save( file_image& f,
+               Elf64_Off   header_offset,
+               Elf64_Off   data_offset )
     {
         ph.p_offset = data_offset;
         ph.p_offset = convertor(ph.p_offset);
-        f.seekp( header_offset );
-        f.write( reinterpret_cast<const char*>( &ph ), sizeof( ph ) );
+        f.write_at( header_offset, reinterpret_cast<const char*>( &ph ),
+                    sizeof( ph ) );
     }
 
 //------------------------------------------------------------------------------
   private:
+//------------------------------------------------------------------------------
+    void
+    changed()
+    {
+        if ( 0 != generation ) {
+            ++*generation;
+        }
+    }
+
+//------------------------------------------------------------------------------
     T                     ph;
     Elf_Half              index;
     char*                 data;
-    std::vector<Elf_Half> sections;
+    file_image*           image;
+    Elf64_Off             image_offset;
+    Elf_Xword             image_size;
+    mutable bool          data_requested;
+    std::vector<Elf_Word> sections;
     endianess_convertor  convertor;
+    Elf_Xword*            generation;
     bool                  is_offset_set;
 };
 
@@ -0,0 +1,65 @@
+/*
+Copyright (C) 2001-2015 by Serge Lamikhov-Center
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in
+all copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+THE SOFTWARE.
+*/
+
+
+#ifndef ELFIO_STATS_HPP
+#define ELFIO_STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+
+namespace ELFIO {
+
+//------------------------------------------------------------------------------
+// Process-wide counts of the work done by all elfio objects, for tools
+// reporting where their time and memory went. The counters are only ever
+// added to with relaxed atomics, so keeping them costs next to nothing;
+// take a snapshot before and after to measure a piece of work.
+struct stats
+{
+    std::atomic<uint64_t> objects;        // Sections and segments created
+    std::atomic<uint64_t> buffers;        // Data buffers allocated for them
+    std::atomic<uint64_t> bytes_read;     // From files, or mapped in to read
+    std::atomic<uint64_t> bytes_written;  // Excluding holes left in files
+
+    static stats&
+    get()
+    {
+        static stats counters;
+        return counters;
+    }
+
+    static void
+    count( std::atomic<uint64_t>& counter, uint64_t amount = 1 )
+    {
+        counter.fetch_add( amount, std::memory_order_relaxed );
+    }
+
+  private:
+    stats() : objects( 0 ), buffers( 0 ), bytes_read( 0 ), bytes_written( 0 )
+    {
+    }
+};
+
+} // namespace ELFIO
+
+#endif // ELFIO_STATS_HPP
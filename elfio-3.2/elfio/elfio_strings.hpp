@@ -26,6 +26,10 @@ THE SOFTWARE.
 #include <cstdlib>
 #include <cstring>
 #include <string>
+#include <vector>
+#include <numeric>
+#include <algorithm>
+#include <unordered_map>
 
 namespace ELFIO {
 
@@ -72,7 +76,7 @@ class string_section_accessor
                 string_section->append_data( &empty_string, 1 );
                 current_position++;
             }
-            string_section->append_data( str, (Elf_Word)std::strlen( str ) + 1 );
+            string_section->append_data( str, (Elf_Xword)std::strlen( str ) + 1 );
         }
 
         return current_position;
@@ -91,6 +95,168 @@ class string_section_accessor
     section* string_section;
 };
 
+
+//------------------------------------------------------------------------------
+// Adds strings to a string table, reusing any existing string which is the
+// same as, or ends with, the new one (so ".text" can share the end of
+// ".foo.text"). Keeps a copy of the table and an index of every suffix in
+// it; the copy is brought up to date if the table grows by other means.
+class string_table_builder
+{
+  public:
+//------------------------------------------------------------------------------
+    string_table_builder()
+    {
+        reset();
+    }
+
+//------------------------------------------------------------------------------
+    void
+    reset()
+    {
+        string_section = 0;
+        table.clear();
+        suffixes.clear();
+    }
+
+//------------------------------------------------------------------------------
+    Elf_Word
+    add_string( section* section_, const std::string& str )
+    {
+        return add_strings( section_, std::vector<std::string>( 1, str ) )[0];
+    }
+
+//------------------------------------------------------------------------------
+    // Returns the offsets of 'strs', in the same order. Strings are interned
+    // longest-suffix-first so that shorter ones can share their tails, and
+    // the section is extended once.
+    std::vector<Elf_Word>
+    add_strings( section* section_, const std::vector<std::string>& strs )
+    {
+        sync( section_ );
+
+        size_t old_size = table.size();
+        if ( table.empty() ) {
+            table.push_back( '\0' );
+        }
+
+        std::vector<size_t> order( strs.size() );
+        std::iota( order.begin(), order.end(), 0 );
+        std::sort( order.begin(), order.end(), [&strs]( size_t a, size_t b ) {
+            return std::lexicographical_compare(
+                strs[b].rbegin(), strs[b].rend(),
+                strs[a].rbegin(), strs[a].rend() );
+        } );
+
+        std::vector<Elf_Word> offsets( strs.size() );
+        for ( size_t i : order ) {
+            offsets[i] = intern( strs[i] );
+        }
+
+        if ( table.size() > old_size ) {
+            section_->append_data( table.data() + old_size,
+                                   table.size() - old_size );
+        }
+
+        return offsets;
+    }
+
+//------------------------------------------------------------------------------
+  private:
+    // Start again if the table is a different one or has shrunk, and index
+    // anything appended to it since last time
+    void
+    sync( section* section_ )
+    {
+        Elf_Xword size = section_->get_size();
+        if ( section_ != string_section || size < table.size() ) {
+            reset();
+            string_section = section_;
+        }
+
+        if ( size > table.size() ) {
+            size_t      old_size = table.size();
+            const char* data     = section_->get_data();
+            if ( 0 != data ) {
+                table.append( data + old_size, size - old_size );
+            }
+            else {
+                table.resize( size, '\0' );
+            }
+            index_strings( old_size, table.size() );
+        }
+    }
+
+//------------------------------------------------------------------------------
+    void
+    index_strings( size_t from, size_t to )
+    {
+        size_t start = from;
+        for ( size_t pos = from; pos < to; ++pos ) {
+            if ( '\0' == table[pos] ) {
+                if ( pos > start ) {
+                    index_string( start, pos - start );
+                }
+                start = pos + 1;
+            }
+        }
+    }
+
+//------------------------------------------------------------------------------
+    // Hashes are computed from the end of the string, so that the hash of a
+    // suffix doesn't depend on which string it is the end of
+    void
+    index_string( size_t offset, size_t length )
+    {
+        uint64_t hash = 0;
+        uint64_t power = 1;
+        for ( size_t i = length; i > 0; --i ) {
+            hash  += (unsigned char)table[offset + i - 1] * power;
+            power *= hash_multiplier;
+            suffixes.insert( std::make_pair( hash, (Elf_Word)( offset + i - 1 ) ) );
+        }
+    }
+
+//------------------------------------------------------------------------------
+    Elf_Word
+    intern( const std::string& str )
+    {
+        if ( str.empty() ) {
+            return 0;
+        }
+
+        uint64_t hash  = 0;
+        uint64_t power = 1;
+        for ( size_t i = str.size(); i > 0; --i ) {
+            hash  += (unsigned char)str[i - 1] * power;
+            power *= hash_multiplier;
+        }
+
+        // Compare the terminating nul too, so only whole suffixes match
+        size_t length = str.size() + 1;
+        auto   range  = suffixes.equal_range( hash );
+        for ( auto it = range.first; it != range.second; ++it ) {
+            if ( it->second + length <= table.size() &&
+                 0 == table.compare( it->second, length, str.c_str(), length ) ) {
+                return it->second;
+            }
+        }
+
+        Elf_Word offset = (Elf_Word)table.size();
+        table.append( str.c_str(), length );
+        index_string( offset, str.size() );
+
+        return offset;
+    }
+
+//------------------------------------------------------------------------------
+    static const uint64_t hash_multiplier = 1099511628211ULL;
+
+    section*                                     string_section;
+    std::string                                  table;
+    std::unordered_multimap<uint64_t, Elf_Word>  suffixes;
+};
+
 } // namespace ELFIO
 
 #endif // ELFIO_STRINGS_HPP
@@ -35,6 +35,7 @@ class symbol_section_accessor
                              symbol_section( symbol_section_ )
     {
         find_hash_section();
+        name_table_built = false;
     }
 
 //------------------------------------------------------------------------------
@@ -84,29 +85,30 @@ class symbol_section_accessor
                 Elf_Half&          section_index,
                 unsigned char&     other ) const
     {
-        bool ret = false;
+        Elf_Xword   index;
+        std::string str;
 
-        if ( 0 != get_hash_table_index() ) {
-            Elf_Word nbucket = *(Elf_Word*)hash_section->get_data();
-            Elf_Word nchain  = *(Elf_Word*)( hash_section->get_data() +
-                                   sizeof( Elf_Word ) );
-            Elf_Word val     = elf_hash( (const unsigned char*)name.c_str() );
-
-            Elf_Word y   = *(Elf_Word*)( hash_section->get_data() +
-                               ( 2 + val % nbucket ) * sizeof( Elf_Word ) );
-            std::string   str;
-            get_symbol( y, str, value, size, bind, type, section_index, other );
-            while ( str != name && STN_UNDEF != y && y < nchain ) {
-                y = *(Elf_Word*)( hash_section->get_data() +
-                        ( 2 + nbucket + y ) * sizeof( Elf_Word ) );
-                get_symbol( y, str, value, size, bind, type, section_index, other );
-            }
-            if (  str == name ) {
-                ret = true;
-            }
+        return find_symbol( name, index ) &&
+               get_symbol( index, str, value, size, bind, type, section_index,
+                           other );
+    }
+
+//------------------------------------------------------------------------------
+    // Uses the file's .gnu.hash or .hash section for this table if there is
+    // one (a .gnu.hash only covers defined symbols). Otherwise a hash table
+    // of the symbol names is built on the first call, and the first symbol
+    // of a given name is found.
+    bool
+    find_symbol( const std::string& name, Elf_Xword& index ) const
+    {
+        if ( 0 != hash_section && SHT_GNU_HASH == hash_section->get_type() ) {
+            return find_gnu_hash_symbol( name.c_str(), index );
+        }
+        if ( 0 != hash_section ) {
+            return find_hash_symbol( name.c_str(), index );
         }
 
-        return ret;
+        return find_indexed_symbol( name.c_str(), index );
     }
 
 //------------------------------------------------------------------------------
@@ -176,10 +178,15 @@ class symbol_section_accessor
     {
         hash_section       = 0;
         hash_section_index = 0;
-        Elf_Half nSecNo = elf_file.sections.size();
-        for ( Elf_Half i = 0; i < nSecNo && 0 == hash_section_index; ++i ) {
+        Elf_Word nSecNo = elf_file.sections.size();
+        for ( Elf_Word i = 0; i < nSecNo; ++i ) {
             const section* sec = elf_file.sections[i];
-            if ( sec->get_link() == symbol_section->get_index() ) {
+            if ( sec->get_link() != symbol_section->get_index() ) {
+                continue;
+            }
+            // Prefer .gnu.hash, which also filters misses with a bloom filter
+            if ( SHT_GNU_HASH == sec->get_type() ||
+                 ( SHT_HASH == sec->get_type() && 0 == hash_section ) ) {
                 hash_section       = sec;
                 hash_section_index = i;
             }
@@ -187,14 +194,211 @@ class symbol_section_accessor
     }
 
 //------------------------------------------------------------------------------
-    Elf_Half
+    const char*
+    get_symbol_name( Elf_Xword index ) const
+    {
+        const char* sym = symbol_section->get_data();
+        if ( 0 == sym || index >= get_symbols_num() ) {
+            return 0;
+        }
+        sym += index * symbol_section->get_entry_size();
+
+        const endianess_convertor& convertor = elf_file.get_convertor();
+        Elf_Word name;
+        if ( elf_file.get_class() == ELFCLASS32 ) {
+            name = convertor( reinterpret_cast<const Elf32_Sym*>( sym )->st_name );
+        }
+        else {
+            name = convertor( reinterpret_cast<const Elf64_Sym*>( sym )->st_name );
+        }
+
+        string_section_accessor str_reader(
+            elf_file.sections[get_string_table_index()] );
+        return str_reader.get_string( name );
+    }
+
+//------------------------------------------------------------------------------
+    bool
+    symbol_has_name( Elf_Xword index, const char* name ) const
+    {
+        const char* str = get_symbol_name( index );
+        return 0 != str && 0 == std::strcmp( str, name );
+    }
+
+//------------------------------------------------------------------------------
+    // Word 'n' of the hash section, or 0 if it is out of range
+    Elf_Word
+    get_hash_word( Elf_Xword n ) const
+    {
+        const char* data = hash_section->get_data();
+        if ( 0 == data || ( n + 1 ) * sizeof( Elf_Word ) > hash_section->get_size() ) {
+            return 0;
+        }
+
+        Elf_Word word;
+        std::memcpy( &word, data + n * sizeof( Elf_Word ), sizeof( word ) );
+        return elf_file.get_convertor()( word );
+    }
+
+//------------------------------------------------------------------------------
+    Elf_Xword
+    get_hash_xword( Elf_Xword n ) const
+    {
+        const char* data = hash_section->get_data();
+        if ( 0 == data || ( n + 2 ) * sizeof( Elf_Word ) > hash_section->get_size() ) {
+            return 0;
+        }
+
+        Elf_Xword word;
+        std::memcpy( &word, data + n * sizeof( Elf_Word ), sizeof( word ) );
+        return elf_file.get_convertor()( word );
+    }
+
+//------------------------------------------------------------------------------
+    bool
+    find_hash_symbol( const char* name, Elf_Xword& index ) const
+    {
+        Elf_Word nbucket = get_hash_word( 0 );
+        Elf_Word nchain  = get_hash_word( 1 );
+        if ( 0 == nbucket ) {
+            return false;
+        }
+
+        Elf_Word val = elf_hash( (const unsigned char*)name );
+        Elf_Word y   = get_hash_word( 2 + val % nbucket );
+        // Bounded by nchain, in case the chain is corrupt
+        for ( Elf_Word steps = 0; STN_UNDEF != y && y < nchain && steps < nchain;
+              ++steps ) {
+            if ( symbol_has_name( y, name ) ) {
+                index = y;
+                return true;
+            }
+            y = get_hash_word( 2 + (Elf_Xword)nbucket + y );
+        }
+
+        return false;
+    }
+
+//------------------------------------------------------------------------------
+    bool
+    find_gnu_hash_symbol( const char* name, Elf_Xword& index ) const
+    {
+        Elf_Word nbucket    = get_hash_word( 0 );
+        Elf_Word symoffset  = get_hash_word( 1 );
+        Elf_Word bloom_size = get_hash_word( 2 );
+        Elf_Word bloom_shift = get_hash_word( 3 );
+        if ( 0 == nbucket || 0 == bloom_size ) {
+            return false;
+        }
+
+        // Bloom filter words are the size of an address
+        Elf_Word word_bits  = elf_file.get_class() == ELFCLASS32 ? 32 : 64;
+        Elf_Word word_words = word_bits / 32;
+        Elf_Word h          = gnu_hash( (const unsigned char*)name );
+
+        Elf_Xword bloom_index = 4 + (Elf_Xword)( ( h / word_bits ) % bloom_size ) *
+                                    word_words;
+        Elf_Xword bloom = 2 == word_words ? get_hash_xword( bloom_index )
+                                          : get_hash_word( bloom_index );
+        Elf_Xword mask = ( (Elf_Xword)1 << ( h % word_bits ) ) |
+                         ( (Elf_Xword)1 << ( ( h >> bloom_shift ) % word_bits ) );
+        if ( ( bloom & mask ) != mask ) {
+            return false;
+        }
+
+        Elf_Xword buckets = 4 + (Elf_Xword)bloom_size * word_words;
+        Elf_Xword chains  = buckets + nbucket;
+        Elf_Word  y       = get_hash_word( buckets + h % nbucket );
+        if ( y < symoffset ) {
+            return false;
+        }
+
+        for ( Elf_Xword n = get_symbols_num(); y < n; ++y ) {
+            Elf_Word chain_hash = get_hash_word( chains + y - symoffset );
+            if ( ( chain_hash | 1 ) == ( h | 1 ) && symbol_has_name( y, name ) ) {
+                index = y;
+                return true;
+            }
+            if ( chain_hash & 1 ) {
+                break;
+            }
+        }
+
+        return false;
+    }
+
+//------------------------------------------------------------------------------
+    // Open addressing, keyed by gnu_hash(); slots hold symbol indexes, with
+    // 0 (the null symbol) marking an empty slot
+    bool
+    find_indexed_symbol( const char* name, Elf_Xword& index ) const
+    {
+        if ( !name_table_built ) {
+            build_name_table();
+        }
+        if ( name_table.empty() ) {
+            return false;
+        }
+
+        size_t mask = name_table.size() - 1;
+        for ( size_t slot = gnu_hash( (const unsigned char*)name ) & mask;
+              0 != name_table[slot]; slot = ( slot + 1 ) & mask ) {
+            if ( symbol_has_name( name_table[slot], name ) ) {
+                index = name_table[slot];
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+//------------------------------------------------------------------------------
+    void
+    build_name_table() const
+    {
+        name_table_built = true;
+        name_table.clear();
+
+        Elf_Xword num = get_symbols_num();
+        if ( num < 2 || num > 0xffffffff ) {
+            return;
+        }
+
+        // At most half full
+        size_t capacity = 16;
+        while ( capacity < 2 * num ) {
+            capacity *= 2;
+        }
+        name_table.assign( capacity, 0 );
+
+        size_t mask = capacity - 1;
+        for ( Elf_Xword i = 1; i < num; ++i ) {
+            const char* name = get_symbol_name( i );
+            if ( 0 == name || '\0' == *name ) {
+                continue;
+            }
+
+            size_t slot = gnu_hash( (const unsigned char*)name ) & mask;
+            for ( ; 0 != name_table[slot]; slot = ( slot + 1 ) & mask ) {
+                if ( symbol_has_name( name_table[slot], name ) ) {
+                    break;    // The earlier symbol of this name wins
+                }
+            }
+            if ( 0 == name_table[slot] ) {
+                name_table[slot] = (Elf_Word)i;
+            }
+        }
+    }
+
+//------------------------------------------------------------------------------
+    Elf_Word
     get_string_table_index() const
     {
-        return (Elf_Half)symbol_section->get_link();
+        return (Elf_Word)symbol_section->get_link();
     }
 
 //------------------------------------------------------------------------------
-    Elf_Half
+    Elf_Word
     get_hash_table_index() const
     {
         return hash_section_index;
@@ -269,8 +473,10 @@ class symbol_section_accessor
   private:
     const elfio&   elf_file;
     section*       symbol_section;
-    Elf_Half       hash_section_index;
+    Elf_Word       hash_section_index;
     const section* hash_section;
+    mutable bool                  name_table_built;
+    mutable std::vector<Elf_Word> name_table;
 };
 
 } // namespace ELFIO
@@ -204,6 +204,18 @@ elf_hash( const unsigned char *name )
     return h;
 }
 
+//------------------------------------------------------------------------------
+inline
+uint32_t
+gnu_hash( const unsigned char *name )
+{
+    uint32_t h = 5381;
+    while ( *name ) {
+        h = ( h << 5 ) + h + *name++;
+    }
+    return h;
+}
+
 } // namespace ELFIO
 
 #endif // ELFIO_UTILS_HPP
@@ -0,0 +1,30 @@
+#include <string>
+#include "elfio/elfio.hpp"
+
+/* A synthetic ELF file, as made by objgen. Each segment holds segmentSize
+ * bytes of section data, split between its share of the sections, and then
+ * bssSize bytes of bss. Symbols and relocations point at random places in
+ * the sections. The same spec always gives the same file. With zeroFill the
+ * sections hold zeros, which take no memory to build and are left as holes
+ * when the file is saved. */
+struct GenerateSpec {
+	unsigned char fileClass;     /* ELFCLASS32 or ELFCLASS64 */
+	unsigned char encoding;      /* ELFDATA2LSB or ELFDATA2MSB */
+	unsigned sections;
+	unsigned segments;
+	ELFIO::Elf_Xword segmentSize;
+	ELFIO::Elf_Xword bssSize;
+	unsigned symbols;
+	unsigned relocations;
+	uint64_t seed;
+	ELFIO::Elf64_Addr base;
+	bool zeroFill;
+
+	GenerateSpec() : fileClass(ELFCLASS64), encoding(ELFDATA2LSB), sections(16),
+		segments(4), segmentSize(64 * 1024), bssSize(0), symbols(1000),
+		relocations(0), seed(1), base(0x400000), zeroFill(false) { }
+};
+
+/* Throws ParseError if the spec can't be made into an ELF file */
+void generateElf(const GenerateSpec &spec, ELFIO::elfio &elf);
+std::string generatedSymbolName(unsigned index);
@@ -4,12 +4,18 @@
 #include <algorithm>
 #include <tclap/CmdLine.h>
 #include <inttypes.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
 
 #include "elfio/elfio.hpp"
 #include "common.hpp"
+#include "tools.hpp"
 
 #define VERSION "0.1"
 
+namespace {
+
 static const ELFIO::Elf64_Addr MipsK0 = 0x80000000;
 static const ELFIO::Elf64_Addr MipsK1 = 0xa0000000;
 
@@ -18,6 +24,16 @@ struct Args {
 	std::vector<std::string> inputs;
 	bool mipsToK0;
 	bool mipsToK1;
+	unsigned jobs;
+	bool mergeAdjacent;
+	ELFIO::Elf_Xword maxGap;
+	bool noSectionHeaders;
+	bool compress;
+	bool binary;
+	std::string base;
+	std::string range;
+	std::string fill;
+	bool stats;
 
 	static Args parse(int argc, char **argv){
 		Args args;
@@ -25,13 +41,39 @@ struct Args {
 		TCLAP::CmdLine cmdLine("elf concatenator", ' ', VERSION);
 		TCLAP::SwitchArg mipsToK0Arg("0", "to-kseg0", "Convert VMAs to kseg0 (MIPS)", cmdLine);
 		TCLAP::SwitchArg mipsToK1Arg("1", "to-kseg1", "Convert VMAs to kseg1 (MIPS)", cmdLine);
+		TCLAP::ValueArg<unsigned> jobsArg("j", "jobs", "Number of inputs to load at once (default: one per CPU)", false, 0, "count", cmdLine);
+		TCLAP::SwitchArg mergeAdjacentArg("m", "merge-segments", "Merge address-adjacent segments with the same flags", cmdLine);
+		TCLAP::ValueArg<std::string> maxGapArg("g", "max-gap", "With -m, also merge segments up to this many bytes apart, zero-filling the gap", false, "0", "bytes", cmdLine);
+		TCLAP::SwitchArg noSectionHeadersArg("s", "no-section-headers", "Leave out the section header table", cmdLine);
+		TCLAP::SwitchArg compressArg("z", "compress", "Compress the file data of each output segment", cmdLine);
+		TCLAP::SwitchArg binaryArg("b", "binary", "Write a raw memory image rather than an ELF file", cmdLine);
+		TCLAP::ValueArg<std::string> baseArg("B", "base", "With -b, the address of the first byte of the image (default: the lowest address written)", false, "", "vaddr", cmdLine);
+		TCLAP::ValueArg<std::string> rangeArg("r", "range", "With -b, only write addresses from start up to (not including) end", false, "", "start-end", cmdLine);
+		TCLAP::ValueArg<std::string> fillArg("f", "fill", "With -b, the byte value for addresses without file data (default 0)", false, "0", "byte", cmdLine);
+		TCLAP::SwitchArg statsArg("", "stats", "Report the time taken by each phase, and the I/O and allocations done, on stderr", cmdLine);
 		TCLAP::UnlabeledMultiArg<std::string> inputArg("inputs", "Input file names", false, "filenames", cmdLine);
 
 		cmdLine.parse(argc, argv);
 
+		if(binaryArg.getValue() && (mergeAdjacentArg.getValue() || maxGapArg.isSet()
+				|| noSectionHeadersArg.getValue() || compressArg.getValue()))
+			throw ParseError("-m, -g, -s and -z only apply to ELF output, and can't be used with -b");
+		if(maxGapArg.isSet() && !mergeAdjacentArg.getValue())
+			throw ParseError("-g only applies when merging segments with -m");
+
 		args.inputs = inputArg.getValue();
 		args.mipsToK0 = mipsToK0Arg.getValue();
 		args.mipsToK1 = mipsToK1Arg.getValue();
+		args.jobs = jobsArg.getValue();
+		args.mergeAdjacent = mergeAdjacentArg.getValue();
+		args.maxGap = std::stoull(maxGapArg.getValue(), 0, 0);
+		args.noSectionHeaders = noSectionHeadersArg.getValue();
+		args.compress = compressArg.getValue();
+		args.binary = binaryArg.getValue();
+		args.base = baseArg.getValue();
+		args.range = rangeArg.getValue();
+		args.fill = fillArg.getValue();
+		args.stats = statsArg.getValue();
 
 		return args;
 	}
@@ -62,63 +104,368 @@ ELFIO::Elf_Xword inventSectionFlags(ELFIO::Elf_Word segmentFlags)
 	return flags;
 }
 
-ELFIO::elfio mergeSegments(std::vector<ELFIO::elfio> &inputElves, ELFIO::Elf64_Addr orVma)
+/* One or more input segments which are output as a single segment */
+struct SegmentRun {
+	std::vector<ELFIO::segment *> parts;
+	ELFIO::elfio *elf;        /* which the first part is from */
+	std::string name;
+	ELFIO::Elf64_Addr vaddr;
+	ELFIO::Elf_Xword fileSize;
+	ELFIO::Elf_Xword memorySize;
+
+	SegmentRun(ELFIO::segment *segment, ELFIO::elfio *elf_, const std::string &name_, ELFIO::Elf64_Addr vaddr_)
+		: parts(1, segment), elf(elf_), name(name_), vaddr(vaddr_),
+		fileSize(segment->get_file_size()), memorySize(segment->get_memory_size()) { }
+
+	/* Whether the segment can be loaded as part of this run: same flags,
+	 * the same vaddr to paddr mapping, not overlapping, and no more than
+	 * maxGap bytes to zero-fill in between. */
+	bool canAppend(ELFIO::segment *segment, ELFIO::Elf64_Addr segmentVaddr, ELFIO::Elf_Xword maxGap) const {
+		ELFIO::segment *first = parts[0];
+		if(segment->get_flags() != first->get_flags())
+			return false;
+
+		if(segmentVaddr < vaddr + memorySize)
+			return false;
+
+		if(segment->get_physical_address() - first->get_physical_address() != segmentVaddr - vaddr)
+			return false;
+
+		/* A segment with file data also turns the run's trailing bss into
+		 * file data */
+		ELFIO::Elf_Xword fill = segment->get_file_size() != 0
+			? segmentVaddr - (vaddr + fileSize)
+			: segmentVaddr - (vaddr + memorySize);
+		return fill <= maxGap;
+	}
+
+	void append(ELFIO::segment *segment, ELFIO::Elf64_Addr segmentVaddr) {
+		parts.push_back(segment);
+		if(segment->get_file_size() != 0)
+			fileSize = segmentVaddr - vaddr + segment->get_file_size();
+		memorySize = segmentVaddr - vaddr + segment->get_memory_size();
+	}
+};
+
+ELFIO::elfio mergeSegments(std::vector<ELFIO::elfio> &inputElves, ELFIO::Elf64_Addr orVma, bool mergeAdjacent, ELFIO::Elf_Xword maxGap, bool compress)
 {
 	auto elfOutput = newFromTemplate(inputElves[0], orVma);
 
+	std::vector<SegmentRun> runs;
 	for(auto &elf : inputElves) {
-
 		for(auto segment: elf.segments) {
 			if(segment->get_type() == PT_LOAD && segment->get_memory_size() != 0) {
-				auto segmentFlags = segment->get_flags();
-				auto segmentFileSize = segment->get_file_size();
-				auto segmentMemorySize = segment->get_memory_size();
+				auto sectionName = inventSectionName(elf.get_name(), segment->get_index(), segment->get_flags(), segment->get_file_size());
+				runs.push_back(SegmentRun(segment, &elf, sectionName, segment->get_virtual_address() | orVma));
+			}
+		}
+	}
 
-				auto sectionName = inventSectionName(elf.get_name(), segment->get_index(), segmentFlags, segmentFileSize);
+	if(mergeAdjacent) {
+		std::stable_sort(runs.begin(), runs.end(), [](const SegmentRun &a, const SegmentRun &b) {
+			return a.vaddr < b.vaddr;
+		});
 
-				auto vaddr = segment->get_virtual_address();
-				vaddr |= orVma;
+		std::vector<SegmentRun> merged;
+		for(auto &run: runs) {
+			if(!merged.empty() && merged.back().canAppend(run.parts[0], run.vaddr, maxGap))
+				merged.back().append(run.parts[0], run.vaddr);
+			else
+				merged.push_back(run);
+		}
+		runs.swap(merged);
+	}
 
-				// std::cout << "memory size " << segment->get_memory_size() << "\n";
-				auto newSection = elfOutput.sections.add(sectionName);
-				newSection->set_type(segmentFileSize == 0 ? SHT_NOBITS : SHT_PROGBITS);
-				newSection->set_flags(inventSectionFlags(segmentFlags));
-				newSection->set_addr_align(4); // TODO
-				newSection->set_data(segment->get_data(), segmentFileSize);
-				newSection->set_size(segmentMemorySize);
-				newSection->set_address(vaddr);
+	/* Name all the new sections at once, so the section name table is
+	 * built in one go. */
+	std::vector<std::string> sectionNames;
+	for(auto &run: runs)
+		sectionNames.push_back(run.name);
 
-				auto newSegment = elfOutput.segments.add();
+	auto newSections = elfOutput.sections.add(sectionNames);
+	std::vector<CompressedSegment> compressedSegments;
 
-				newSegment->set_type(segment->get_type());
-				newSegment->set_flags(segment->get_flags());
-				newSegment->set_align(segment->get_align());
-				newSegment->set_virtual_address(vaddr);
-				newSegment->set_physical_address(segment->get_physical_address());
-				newSegment->add_section_index(newSection->get_index(), newSection->get_addr_align());
+	for(size_t idx = 0; idx < runs.size(); idx++) {
+		auto &run = runs[idx];
+		auto segment = run.parts[0];
+		auto segmentFlags = segment->get_flags();
 
+		// std::cout << "memory size " << segment->get_memory_size() << "\n";
+		auto newSection = newSections[idx];
+		newSection->set_type(run.fileSize == 0 ? SHT_NOBITS : SHT_PROGBITS);
+		newSection->set_flags(inventSectionFlags(segmentFlags));
+		newSection->set_addr_align(4); // TODO
+
+		const char *data = segment->get_data();
+		std::vector<char> joined;
+		if(run.parts.size() > 1) {
+			/* Gaps, and bss followed by file data, become zeroes */
+			joined.resize(run.fileSize, 0);
+			for(auto part: run.parts) {
+				const char *partData = part->get_data();
+				if(partData != nullptr && part->get_file_size() != 0)
+					memcpy(&joined[(part->get_virtual_address() | orVma) - run.vaddr], partData, part->get_file_size());
 			}
+			data = joined.data();
+		}
+
+		/* A compressed segment's file data is the compressed bytes, and a
+		 * bss section after them keeps its memory size. They start at the
+		 * segment's address, so a loader can't decompress them in place.
+		 * Data that doesn't shrink is stored as it is. */
+		std::vector<char> compressed;
+		if(compress && run.fileSize != 0)
+			compressed = compressLz(data, run.fileSize);
+		bool isCompressed = compressed.size() != 0 && compressed.size() < run.fileSize;
+
+		ELFIO::section *padSection = nullptr;
+		if(isCompressed) {
+			newSection->set_data(compressed.data(), compressed.size());
+			newSection->set_address(run.vaddr);
+			if(run.memorySize > compressed.size()) {
+				padSection = elfOutput.sections.add(run.name + ".z");
+				padSection->set_type(SHT_NOBITS);
+				padSection->set_flags(inventSectionFlags(segmentFlags));
+				padSection->set_addr_align(1);
+				padSection->set_size(run.memorySize - compressed.size());
+				padSection->set_address(run.vaddr + compressed.size());
+			}
+		} else {
+			/* A lone segment's data is shared with its input rather than
+			 * copied, so a large one costs no memory and its holes stay
+			 * holes */
+			if(run.parts.size() == 1 && run.fileSize != 0)
+				elfOutput.sections.share_data(newSection, segment, *run.elf);
+			else
+				newSection->set_data(data, run.fileSize);
+			newSection->set_size(run.memorySize);
+			newSection->set_address(run.vaddr);
+		}
+
+		auto newSegment = elfOutput.segments.add();
+
+		newSegment->set_type(segment->get_type());
+		newSegment->set_flags(segment->get_flags());
+		newSegment->set_align(segment->get_align());
+		newSegment->set_virtual_address(run.vaddr);
+		newSegment->set_physical_address(segment->get_physical_address());
+		newSegment->add_section_index(newSection->get_index(), newSection->get_addr_align());
+		if(padSection != nullptr)
+			newSegment->add_section_index(padSection->get_index(), padSection->get_addr_align());
+
+		if(isCompressed) {
+			CompressedSegment entry;
+			entry.segmentIndex = newSegment->get_index();
+			entry.codec = CompressionCodecLz4;
+			entry.fileSize = run.fileSize;
+			entry.compressedSize = compressed.size();
+			compressedSegments.push_back(entry);
 		}
 	}
 
+	if(!compressedSegments.empty())
+		addCompressionNote(elfOutput, compressedSegments);
+
 	return elfOutput;
 }
 
-int main(int argc, char **argv)
+/* The file data of the loadable segments, which make up a raw image */
+struct ImagePiece {
+	ELFIO::Elf64_Addr vaddr;
+	ELFIO::Elf_Xword size;
+	ELFIO::segment *segment;
+	ELFIO::Elf_Xword offset; /* into the segment's data */
+};
+
+struct ImageOptions {
+	bool hasBase;
+	ELFIO::Elf64_Addr base;
+	bool hasRange;
+	ELFIO::Elf64_Addr rangeStart;
+	ELFIO::Elf64_Addr rangeEnd;
+	unsigned char fill;
+};
+
+ImageOptions parseImageOptions(const Args &args)
+{
+	ImageOptions options;
+
+	options.hasBase = args.base != "";
+	options.base = options.hasBase ? std::stoull(args.base, 0, 0) : 0;
+
+	options.hasRange = args.range != "";
+	options.rangeStart = 0;
+	options.rangeEnd = ~(ELFIO::Elf64_Addr)0;
+	if(options.hasRange) {
+		size_t dash = args.range.find("-");
+		if(dash == std::string::npos)
+			throw ParseError("No - found in range (Format: start-end)");
+		options.rangeStart = std::stoull(args.range.substr(0, dash), 0, 0);
+		options.rangeEnd = std::stoull(args.range.substr(dash + 1), 0, 0);
+		if(options.rangeEnd < options.rangeStart)
+			throw ParseError("Range ends before it starts");
+		if(options.hasBase && options.base >= options.rangeEnd)
+			throw ParseError("The base must be below the end of the range");
+	}
+
+	unsigned long fill = std::stoul(args.fill, 0, 0);
+	if(fill > 255)
+		throw ParseError("Fill value must be a byte");
+	options.fill = fill;
+	return options;
+}
+
+/* Bytes without file data: a hole if the output is a regular file not
+ * opened for appending and the fill is zero, otherwise written out. */
+static bool writeFill(int fd, ELFIO::Elf_Xword length, unsigned char fill, bool holes)
+{
+	if(holes)
+		return length == 0 || lseek(fd, length, SEEK_CUR) >= 0;
+
+	std::vector<char> buf(std::min<ELFIO::Elf_Xword>(length, 1024 * 1024), fill);
+	while(length > 0) {
+		size_t chunk = std::min<ELFIO::Elf_Xword>(length, buf.size());
+		if(!writeAll(fd, buf.data(), chunk))
+			return false;
+		length -= chunk;
+	}
+
+	return true;
+}
+
+/* Write the file data of every input's loadable segments to fd as a flat
+ * memory image, straight from the inputs. Bss and gaps between segments
+ * are filled. */
+bool writeImage(std::vector<ELFIO::elfio> &inputElves, ELFIO::Elf64_Addr orVma, const ImageOptions &options, int fd)
+{
+	std::vector<ImagePiece> pieces;
+	for(auto &elf : inputElves) {
+		for(auto segment: elf.segments) {
+			if(segment->get_type() != PT_LOAD || segment->get_file_size() == 0)
+				continue;
+
+			ELFIO::Elf64_Addr start = segment->get_virtual_address() | orVma;
+			ELFIO::Elf64_Addr end = start + segment->get_file_size();
+			ELFIO::Elf64_Addr clipStart = std::max(start, options.rangeStart);
+			if(options.hasBase)
+				clipStart = std::max(clipStart, options.base);
+			ELFIO::Elf64_Addr clipEnd = std::min(end, options.rangeEnd);
+			if(clipStart >= clipEnd)
+				continue;
+
+			ImagePiece piece;
+			piece.vaddr = clipStart;
+			piece.size = clipEnd - clipStart;
+			piece.segment = segment;
+			piece.offset = clipStart - start;
+			pieces.push_back(piece);
+		}
+	}
+
+	std::stable_sort(pieces.begin(), pieces.end(), [](const ImagePiece &a, const ImagePiece &b) {
+		return a.vaddr < b.vaddr;
+	});
+
+	for(size_t i = 1; i < pieces.size(); i++) {
+		if(pieces[i - 1].vaddr + pieces[i - 1].size > pieces[i].vaddr) {
+			std::cerr << "error: segments overlap at 0x" << std::hex << pieces[i].vaddr << std::dec << "\n";
+			return false;
+		}
+	}
+
+	ELFIO::Elf64_Addr position = options.hasBase ? options.base
+		: options.hasRange ? options.rangeStart
+		: pieces.empty() ? 0 : pieces[0].vaddr;
+	ELFIO::Elf64_Addr end = options.hasRange ? options.rangeEnd
+		: pieces.empty() ? position : pieces.back().vaddr + pieces.back().size;
+
+	struct stat st;
+	/* Appending writes go to the end of the file whatever the offset, so a
+	 * hole made by seeking would be lost */
+	bool holes = options.fill == 0 && fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+		&& !(fcntl(fd, F_GETFL) & O_APPEND);
+
+	bool good = true;
+	for(size_t i = 0; good && i < pieces.size(); i++) {
+		const ImagePiece &piece = pieces[i];
+		const char *data = piece.segment->get_data();
+
+		good = data != nullptr
+			&& writeFill(fd, piece.vaddr - position, options.fill, holes)
+			&& writeAll(fd, data + piece.offset, piece.size);
+		position = piece.vaddr + piece.size;
+	}
+
+	good = good && writeFill(fd, end - position, options.fill, holes);
+
+	/* A hole at the end only exists if the file is extended over it */
+	if(good && holes && end > position) {
+		off_t size = lseek(fd, 0, SEEK_CUR);
+		good = size >= 0 && ftruncate(fd, size) == 0;
+	}
+
+	if(!good)
+		std::cerr << "error: failed to write image\n";
+
+	return good;
+}
+
+} /* namespace */
+
+int objcatMain(int argc, char **argv, Pipe &pipe)
 {
 	try {
+		Stats stats;
 		Args args = Args::parse(argc, argv);
 		ELFIO::Elf64_Addr orVma = args.mipsToK0 ? MipsK0 : (args.mipsToK1 ? MipsK1 : 0);
 
-		auto inputs = loadElves(args.inputs);
-		auto output = mergeSegments(inputs, orVma);
-		output.save("-");
+		stats.enter(PhaseLoad);
+		std::vector<ELFIO::elfio> inputs;
+		if(args.inputs.empty() && pipe.hasInput("-")) {
+			/* The previous stage's image was built in memory, and its
+			 * segments only have data once it has been assembled */
+			inputs.push_back(pipe.takeInput());
+			auto image = inputs[0].save_image();
+			if(!image || !inputs[0].load(image))
+				throw LoadError("Failed to assemble the previous stage's output");
+		} else {
+			inputs = loadElves(args.inputs, args.jobs);
+		}
+
+		if(args.binary) {
+			if(pipe.toNextStage) {
+				std::cerr << "error: a raw image can't be passed on to another stage\n";
+				return 1;
+			}
+			stats.enter(PhaseSave);
+			if(!writeImage(inputs, orVma, parseImageOptions(args), STDOUT_FILENO))
+				return 1;
+		} else {
+			stats.enter(PhaseCopy);
+			auto output = mergeSegments(inputs, orVma, args.mergeAdjacent, args.maxGap, args.compress);
+			output.omit_section_table(args.noSectionHeaders);
+			if(pipe.toNextStage) {
+				stats.enter(PhaseLayout);
+				pipe.passOn(std::move(output));
+			} else {
+				saveElf(output, "-", stats);
+			}
+		}
+
+		if(args.stats)
+			stats.report("objcat");
 	} catch (TCLAP::ArgException &e) {
 		std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
 		return 1;
 	} catch (LoadError &e) {
 		std::cerr << "error: " << e.what() << "\n";
 		return 1;
+	} catch (ParseError &e) {
+		std::cerr << "error: " << e.what() << "\n";
+		return 1;
+	} catch (std::logic_error &e) {
+		std::cerr << "error: bad address: " << e.what() << "\n";
+		return 1;
 	}
 
 	return 0;
@@ -0,0 +1,295 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <tclap/CmdLine.h>
+#include <inttypes.h>
+
+#include "elfio/elfio.hpp"
+#include "common.hpp"
+#include "tools.hpp"
+#include "generate.hpp"
+
+#define VERSION "0.1"
+
+namespace {
+
+static const ELFIO::Elf64_Addr SegmentAlign = 0x10000;
+static const ELFIO::Elf_Xword SectionAlign = 16;
+static const unsigned char RelocationType = 1; /* R_PPC_ADDR32 and R_PPC64_ADDR32 */
+
+/* xorshift64*, so the output only depends on the seed */
+struct Random {
+	uint64_t state;
+
+	Random(uint64_t seed) {
+		/* splitmix64 of the seed, which is never left at zero */
+		state = seed + 0x9e3779b97f4a7c15ull;
+		state = (state ^ (state >> 30)) * 0xbf58476d1ce4e5b9ull;
+		state = (state ^ (state >> 27)) * 0x94d049bb133111ebull;
+		state ^= state >> 31;
+		if(state == 0)
+			state = 1;
+	}
+
+	uint64_t next() {
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 2685821657736338717ull;
+	}
+
+	uint64_t below(uint64_t limit) {
+		return limit == 0 ? 0 : next() % limit;
+	}
+
+	/* Byte by byte, so the contents don't depend on the host's byte order */
+	void fill(std::vector<char> &data) {
+		size_t i = 0;
+		while(i < data.size()) {
+			uint64_t value = next();
+			for(int byte = 0; byte < 8 && i < data.size(); byte++, i++)
+				data[i] = (char)(value >> (byte * 8));
+		}
+	}
+};
+
+struct Args {
+	GenerateSpec spec;
+	std::string output;
+
+	static ELFIO::Elf_Xword parseSize(const std::string &text) {
+		size_t end;
+		ELFIO::Elf_Xword size = std::stoull(text, &end, 0);
+		std::string suffix = text.substr(end);
+
+		if(suffix == "K" || suffix == "k")
+			return size << 10;
+		if(suffix == "M" || suffix == "m")
+			return size << 20;
+		if(suffix == "G" || suffix == "g")
+			return size << 30;
+		if(suffix != "")
+			throw ParseError("Unknown size suffix " + suffix + " (use K, M or G)");
+		return size;
+	}
+
+	static Args parse(int argc, char **argv){
+		Args args;
+
+		TCLAP::CmdLine cmdLine("synthetic ELF file generator", ' ', VERSION);
+		TCLAP::ValueArg<std::string> outputArg("o", "output", "Output file name", false, "-", "filename", cmdLine);
+		TCLAP::ValueArg<unsigned> classArg("c", "class", "32 or 64 (default 64)", false, 64, "bits", cmdLine);
+		TCLAP::SwitchArg bigEndianArg("E", "big-endian", "Make a big-endian file", cmdLine);
+		TCLAP::ValueArg<unsigned> sectionsArg("n", "sections", "Number of sections with data (default 16)", false, 16, "count", cmdLine);
+		TCLAP::ValueArg<unsigned> segmentsArg("l", "segments", "Number of loadable segments (default 4)", false, 4, "count", cmdLine);
+		TCLAP::ValueArg<std::string> segmentSizeArg("z", "segment-size", "Bytes of section data in each segment, optionally with a K, M or G suffix (default 64K)", false, "64K", "bytes", cmdLine);
+		TCLAP::ValueArg<std::string> bssSizeArg("b", "bss-size", "Bytes of bss at the end of each segment (default 0)", false, "0", "bytes", cmdLine);
+		TCLAP::ValueArg<unsigned> symbolsArg("y", "symbols", "Number of symbols (default 1000)", false, 1000, "count", cmdLine);
+		TCLAP::ValueArg<unsigned> relocationsArg("r", "relocations", "Number of relocations (default 0)", false, 0, "count", cmdLine);
+		TCLAP::ValueArg<uint64_t> seedArg("s", "seed", "Seed for the contents (default 1)", false, 1, "number", cmdLine);
+		TCLAP::ValueArg<std::string> baseArg("B", "base", "Address of the first segment (default 0x400000)", false, "0x400000", "vaddr", cmdLine);
+		TCLAP::SwitchArg zeroFillArg("Z", "zero-fill", "Fill the sections with zeros, which are written as holes, rather than random data", cmdLine);
+
+		cmdLine.parse(argc, argv);
+
+		if(classArg.getValue() != 32 && classArg.getValue() != 64)
+			throw ParseError("The class must be 32 or 64");
+
+		args.output = outputArg.getValue();
+		args.spec.fileClass = classArg.getValue() == 32 ? ELFCLASS32 : ELFCLASS64;
+		args.spec.encoding = bigEndianArg.getValue() ? ELFDATA2MSB : ELFDATA2LSB;
+		args.spec.sections = sectionsArg.getValue();
+		args.spec.segments = segmentsArg.getValue();
+		args.spec.segmentSize = parseSize(segmentSizeArg.getValue());
+		args.spec.bssSize = parseSize(bssSizeArg.getValue());
+		args.spec.symbols = symbolsArg.getValue();
+		args.spec.relocations = relocationsArg.getValue();
+		args.spec.seed = seedArg.getValue();
+		args.spec.base = std::stoull(baseArg.getValue(), 0, 0);
+		args.spec.zeroFill = zeroFillArg.getValue();
+
+		return args;
+	}
+};
+
+} /* namespace */
+
+std::string generatedSymbolName(unsigned index)
+{
+	return "sym" + std::to_string(index);
+}
+
+void generateElf(const GenerateSpec &spec, ELFIO::elfio &elf)
+{
+	if(spec.segments == 0 || spec.sections < spec.segments)
+		throw ParseError("There must be at least one segment, and at least one section per segment");
+
+	bool hasSymtab = spec.symbols != 0 || spec.relocations != 0;
+	unsigned bssSections = spec.bssSize != 0 ? spec.segments : 0;
+
+	ELFIO::Elf_Xword segmentStride = (spec.segmentSize + spec.bssSize + SegmentAlign - 1) & ~(SegmentAlign - 1);
+	ELFIO::Elf64_Addr addressLimit = spec.fileClass == ELFCLASS32 ? 0xffffffffull : ~0ull;
+	if(spec.base > addressLimit || (addressLimit - spec.base) / spec.segments < segmentStride)
+		throw ParseError("The segments don't fit in the address space");
+
+	elf.create(spec.fileClass, spec.encoding);
+	elf.set_type(ET_EXEC);
+	elf.set_machine(spec.fileClass == ELFCLASS32 ? EM_PPC : EM_PPC64);
+	elf.set_entry(spec.base);
+
+	/* All the names at once, so the section name table is built in one go */
+	std::vector<std::string> names;
+	for(unsigned i = 0; i < spec.sections; i++)
+		names.push_back(".text.f" + std::to_string(i));
+	for(unsigned i = 0; i < bssSections; i++)
+		names.push_back(".bss." + std::to_string(i));
+	auto sections = elf.sections.add(names);
+
+	Random random(spec.seed);
+	std::vector<char> data;
+	unsigned sectionIdx = 0;
+	for(unsigned segmentIdx = 0; segmentIdx < spec.segments; segmentIdx++) {
+		ELFIO::Elf64_Addr vaddr = spec.base + segmentIdx * segmentStride;
+
+		auto segment = elf.segments.add();
+		segment->set_type(PT_LOAD);
+		segment->set_flags(PF_R | PF_X);
+		segment->set_align(SegmentAlign);
+		segment->set_virtual_address(vaddr);
+		segment->set_physical_address(vaddr);
+
+		/* The first few segments take a section each of any left over */
+		unsigned count = spec.sections / spec.segments + (segmentIdx < spec.sections % spec.segments ? 1 : 0);
+		ELFIO::Elf_Xword sectionSize = (spec.segmentSize / count) & ~(SectionAlign - 1);
+		ELFIO::Elf64_Addr address = vaddr;
+
+		for(unsigned i = 0; i < count; i++, sectionIdx++) {
+			ELFIO::Elf_Xword size = i + 1 < count ? sectionSize : vaddr + spec.segmentSize - address;
+
+			auto section = sections[sectionIdx];
+			section->set_type(SHT_PROGBITS);
+			section->set_flags(SHF_ALLOC | SHF_EXECINSTR);
+			section->set_addr_align(SectionAlign);
+			section->set_address(address);
+			if(spec.zeroFill) {
+				/* No data, so the file space is left zero */
+				section->set_size(size);
+			} else {
+				data.resize(size);
+				random.fill(data);
+				section->set_data(data.data(), size);
+			}
+			segment->add_section_index(section->get_index(), section->get_addr_align());
+
+			address += size;
+		}
+
+		if(bssSections != 0) {
+			auto bss = sections[spec.sections + segmentIdx];
+			bss->set_type(SHT_NOBITS);
+			bss->set_flags(SHF_ALLOC | SHF_WRITE);
+			bss->set_addr_align(1);
+			bss->set_address(address);
+			bss->set_size(spec.bssSize);
+			segment->add_section_index(bss->get_index(), bss->get_addr_align());
+		}
+	}
+
+	if(!hasSymtab)
+		return;
+
+	auto strtab = elf.sections.add(".strtab");
+	strtab->set_type(SHT_STRTAB);
+	auto symtab = elf.sections.add(".symtab");
+	symtab->set_type(SHT_SYMTAB);
+	symtab->set_link(strtab->get_index());
+	symtab->set_info(1);  /* Everything but the null symbol is global */
+	symtab->set_addr_align(spec.fileClass == ELFCLASS32 ? 4 : 8);
+	symtab->set_entry_size(elf.get_default_entry_size(SHT_SYMTAB));
+
+	/* A random place somewhere in the section data */
+	auto pickAddress = [&](ELFIO::Elf_Word &index) {
+		ELFIO::section *section = sections[random.below(spec.sections)];
+		index = section->get_index();
+		return section->get_address() + random.below(section->get_size());
+	};
+
+	/* Symbols in sections from SHN_LORESERVE up get SHN_XINDEX, and their
+	 * section index goes in .symtab_shndx, which has a word per symbol */
+	ELFIO::section *symtabShndx = nullptr;
+	std::vector<ELFIO::Elf_Word> shndx(1, 0);
+	if(sections[spec.sections - 1]->get_index() >= SHN_LORESERVE) {
+		symtabShndx = elf.sections.add(".symtab_shndx");
+		symtabShndx->set_type(SHT_SYMTAB_SHNDX);
+		symtabShndx->set_link(symtab->get_index());
+		symtabShndx->set_addr_align(4);
+		symtabShndx->set_entry_size(sizeof(ELFIO::Elf_Word));
+	}
+
+	const ELFIO::endianess_convertor &convertor = elf.get_convertor();
+	ELFIO::string_section_accessor strings(strtab);
+	ELFIO::symbol_section_accessor symbols(elf, symtab);
+	for(unsigned i = 0; i < spec.symbols; i++) {
+		ELFIO::Elf_Word index;
+		ELFIO::Elf64_Addr value = pickAddress(index);
+		bool escaped = index >= SHN_LORESERVE;
+		symbols.add_symbol(strings, generatedSymbolName(i).c_str(), value, 4, STB_GLOBAL, STT_FUNC, 0,
+			escaped ? (ELFIO::Elf_Half)SHN_XINDEX : (ELFIO::Elf_Half)index);
+		if(symtabShndx != nullptr)
+			shndx.push_back(convertor(escaped ? index : 0));
+	}
+
+	if(symtabShndx != nullptr)
+		symtabShndx->set_data(reinterpret_cast<const char *>(shndx.data()), shndx.size() * sizeof(ELFIO::Elf_Word));
+
+	if(spec.relocations == 0)
+		return;
+
+	auto rela = elf.sections.add(".rela.text");
+	rela->set_type(SHT_RELA);
+	rela->set_link(symtab->get_index());
+	rela->set_info(sections[0]->get_index());
+	rela->set_addr_align(spec.fileClass == ELFCLASS32 ? 4 : 8);
+	rela->set_entry_size(elf.get_default_entry_size(SHT_RELA));
+
+	ELFIO::relocation_section_accessor relocations(elf, rela);
+	for(unsigned i = 0; i < spec.relocations; i++) {
+		ELFIO::Elf_Word index;
+		ELFIO::Elf64_Addr offset = pickAddress(index);
+		ELFIO::Elf_Word symbol = spec.symbols == 0 ? 0 : 1 + random.below(spec.symbols);
+		relocations.add_entry(offset, symbol, RelocationType, (ELFIO::Elf_Sxword)random.below(256));
+	}
+}
+
+int objgenMain(int argc, char **argv, Pipe &pipe)
+{
+	try {
+		Args args = Args::parse(argc, argv);
+
+		if(pipe.toNextStage && args.output != "-") {
+			std::cerr << "error: -o can't be used before another stage\n";
+			return 1;
+		}
+
+		ELFIO::elfio elf;
+		generateElf(args.spec, elf);
+
+		if(pipe.toNextStage) {
+			pipe.passOn(std::move(elf));
+		} else if(!elf.save(args.output)) {
+			std::cerr << "error: failed to write " << args.output << "\n";
+			return 1;
+		}
+	} catch (TCLAP::ArgException &e) {
+		std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
+		return 1;
+	} catch (ParseError &e) {
+		std::cerr << "error: " << e.what() << "\n";
+		return 1;
+	} catch (std::logic_error &e) {
+		std::cerr << "error: bad number: " << e.what() << "\n";
+		return 1;
+	}
+
+	return 0;
+}
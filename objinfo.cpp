@@ -1,15 +1,21 @@
 #include <vector>
 #include <string>
 #include <iostream>
+#include <fstream>
+#include <sstream>
 #include <algorithm>
+#include <unordered_map>
 #include <tclap/CmdLine.h>
 #include <inttypes.h>
 
 #include "elfio/elfio.hpp"
 #include "common.hpp"
+#include "tools.hpp"
 
 #define VERSION "0.1"
 
+namespace {
+
 const std::string MagicSigma0InfoStructName = "sigma0_info";
 
 static const ELFIO::Elf64_Addr MipsKernelSpace = 0x80000000;
@@ -34,7 +40,9 @@ struct Args {
 	bool printLowestVaddr;
 	bool printEntry;
 	std::string printSymbolValue;
+	std::string batch;
 	std::string input;
+	bool stats;
 
 	static Args parse(int argc, char **argv){
 		Args args;
@@ -47,6 +55,8 @@ struct Args {
 		TCLAP::ValueArg<std::string> printSymbolValueArg("S", "symbol-value", "Display symbol value", false, "", "sym", cmdLine);
 		TCLAP::SwitchArg mipsUserToKernelArg("1", "to-kseg0", "Convert MIPS VMAs to kseg1", cmdLine);
 		TCLAP::SwitchArg mipsKernelToUserArg("0", "to-kuseg", "Convert MIPS VMAs to kuseg", cmdLine);
+		TCLAP::ValueArg<std::string> batchArg("b", "batch", "Answer the queries listed in a file (- for stdin)", false, "", "filename", cmdLine);
+		TCLAP::SwitchArg statsArg("", "stats", "Report the time taken by each phase, and the I/O and allocations done, on stderr", cmdLine);
 		TCLAP::UnlabeledValueArg<std::string> inputArg("input", "Input (default stdin)", false, "-", "filename", cmdLine);
 
 		cmdLine.parse(argc, argv);
@@ -58,7 +68,9 @@ struct Args {
 		args.roundToPage = roundToPageArg.getValue();
 		args.mips0to1 = mipsUserToKernelArg.getValue();
 		args.mips1to0 = mipsKernelToUserArg.getValue();
+		args.batch = batchArg.getValue();
 		args.input = inputArg.getValue();
+		args.stats = statsArg.getValue();
 
 		return args;
 	}
@@ -126,23 +138,15 @@ ELFIO::section *getSymbolTable(ELFIO::elfio &elf)
 	return nullptr;
 }
 
-bool findSymbolForName(ELFIO::symbol_section_accessor syms, ELFIO::Elf64_Addr &value, ELFIO::Elf_Half &section_index, std::string &name)
+bool findSymbolForName(const ELFIO::symbol_section_accessor &syms, ELFIO::Elf64_Addr &value, ELFIO::Elf_Half &section_index, const std::string &name)
 {
 	ELFIO::Elf_Xword size;
 	unsigned char bind;
 	unsigned char type;
 	unsigned char other;
-	std::string candidateName;
-
-	ELFIO::Elf_Xword numSymbols = syms.get_symbols_num();
-	for(ELFIO::Elf_Xword i = 0; i < numSymbols; i++) {
-		syms.get_symbol(i, candidateName, value, size, bind, type, section_index, other);
-		if(candidateName == name) {
-			return true;
-		}
-	}
 
-	return false;
+	/* Hashed, so repeated lookups with the same accessor are cheap */
+	return syms.get_symbol(name, value, size, bind, type, section_index, other);
 }
 
 bool findSymbolValue(ELFIO::elfio &elf, std::string &name, ELFIO::Elf64_Addr &value)
@@ -159,37 +163,241 @@ bool findSymbolValue(ELFIO::elfio &elf, std::string &name, ELFIO::Elf64_Addr &va
 	return findSymbolForName(syms, value, section_index, name);
 }
 
-int main(int argc, char **argv)
+/*
+ * Batch queries: one per line, answered from a single load of the ELF.
+ *
+ *   sym NAME      value of symbol NAME
+ *   entry         entry point
+ *   highest       highest vaddr (as -> would print it)
+ *   lowest        lowest vaddr (as -< would print it)
+ *   addr 0xADDR   symbol containing ADDR, as NAME or NAME+0xOFFSET
+ *
+ * Each query produces one line, in order: the query as written, a tab, and
+ * the answer, or "-" if there isn't one.
+ */
+struct Query {
+	enum QueryKind {Symbol, Entry, Highest, Lowest, Address};
+
+	QueryKind kind;
+	std::string text;
+	std::string name;
+	ELFIO::Elf64_Addr addr;
+
+	std::string answer;
+	ELFIO::Elf64_Addr bestOffset;
+
+	Query(const std::string &line) : text(line), addr(0), answer("-"), bestOffset(~(ELFIO::Elf64_Addr)0) {
+		std::istringstream words(line);
+		std::string word, extra;
+		words >> word;
+
+		if(word == "sym" && words >> name) {
+			kind = Symbol;
+		} else if(word == "entry") {
+			kind = Entry;
+		} else if(word == "highest") {
+			kind = Highest;
+		} else if(word == "lowest") {
+			kind = Lowest;
+		} else if(word == "addr" && words >> word) {
+			kind = Address;
+			addr = std::stoull(word, 0, 0);
+		} else {
+			throw std::invalid_argument("Unknown query: " + line);
+		}
+
+		if(words >> extra) {
+			throw std::invalid_argument("Unexpected text after query: " + line);
+		}
+	}
+};
+
+static std::string hexString(ELFIO::Elf64_Addr value)
 {
-	try {
-		Args args = Args::parse(argc, argv);
-		auto input = loadElf(args.input);
+	std::ostringstream hex;
+	hex << "0x" << std::hex << value;
+	return hex.str();
+}
+
+std::vector<Query> readQueries(std::istream &stream)
+{
+	std::vector<Query> queries;
+	std::string line;
+
+	while(std::getline(stream, line)) {
+		if(line.find_first_not_of(" \t") == std::string::npos || line[0] == '#')
+			continue;
+		queries.push_back(Query(line));
+	}
+
+	return queries;
+}
+
+/* Answer every symbol and address query in one pass over the symbol table */
+void answerSymbolQueries(ELFIO::elfio &elf, std::vector<Query> &queries)
+{
+	std::unordered_map<std::string, std::vector<Query *>> byName;
+	std::vector<Query *> byAddress;
+
+	for(auto &query: queries) {
+		if(query.kind == Query::Symbol)
+			byName[query.name].push_back(&query);
+		else if(query.kind == Query::Address)
+			byAddress.push_back(&query);
+	}
+
+	ELFIO::section *symtab = getSymbolTable(elf);
+	if((byName.empty() && byAddress.empty()) || symtab == nullptr)
+		return;
 
-		if(args.printHighestVaddr) {
-			ELFIO::Elf64_Addr vaddr = convertVma(findHighestVaddr(input), args);
-			std::cout << "0x" << std::hex << vaddr << std::dec << '\n';
+	ELFIO::symbol_section_accessor syms(elf, symtab);
+	std::string name;
+	ELFIO::Elf64_Addr value;
+	ELFIO::Elf_Xword size;
+	unsigned char bind, type, other;
+	ELFIO::Elf_Half sectionIndex;
+
+	for(auto &named: byName) {
+		if(findSymbolForName(syms, value, sectionIndex, named.first)) {
+			for(auto query: named.second)
+				query->answer = hexString(value);
 		}
-		if(args.printLowestVaddr) {
-			ELFIO::Elf64_Addr vaddr = convertVma(findLowestVaddr(input), args);
-			std::cout << "0x" << std::hex << vaddr << std::dec << '\n';
+	}
+
+	if(byAddress.empty())
+		return;
+
+	ELFIO::Elf_Xword numSymbols = syms.get_symbols_num();
+	for(ELFIO::Elf_Xword i = 0; i < numSymbols; i++) {
+		syms.get_symbol(i, name, value, size, bind, type, sectionIndex, other);
+
+		if(name.empty() || sectionIndex == SHN_UNDEF
+				|| type == STT_SECTION || type == STT_FILE || type == STT_TLS)
+			continue;
+
+		for(auto query: byAddress) {
+			bool contains = size == 0 ? query->addr == value
+				: (query->addr >= value && query->addr - value < size);
+			if(contains && query->addr - value < query->bestOffset) {
+				query->bestOffset = query->addr - value;
+				query->answer = name;
+				if(query->bestOffset)
+					query->answer += "+" + hexString(query->bestOffset);
+			}
 		}
-		if(args.printSymbolValue != "") {
-			ELFIO::Elf64_Addr value;
-			if(findSymbolValue(input, args.printSymbolValue, value)) {
-				std::cout << "0x" << std::hex << value << std::dec << "\n";
-			} else {
-				std::cerr << "No symbol named " << args.printSymbolValue << " found.\n";
+	}
+}
+
+int runBatch(ELFIO::elfio &elf, Args &args, std::ostream &out)
+{
+	std::vector<Query> queries;
+
+	try {
+		if(args.batch == "-") {
+			queries = readQueries(std::cin);
+		} else {
+			std::ifstream batchFile(args.batch);
+			if(!batchFile) {
+				std::cerr << "Couldn't open " << args.batch << "\n";
+				return 1;
 			}
+			queries = readQueries(batchFile);
 		}
-		if(args.printEntry) {
-			std::cout << "0x" << std::hex << input.get_entry() << std::dec << "\n";
+	} catch (std::exception &e) {
+		std::cerr << "error: " << e.what() << "\n";
+		return 1;
+	}
+
+	answerSymbolQueries(elf, queries);
+
+	for(auto &query: queries) {
+		switch(query.kind) {
+			case Query::Entry:
+				query.answer = hexString(elf.get_entry());
+				break;
+			case Query::Highest:
+				query.answer = hexString(convertVma(findHighestVaddr(elf), args));
+				break;
+			case Query::Lowest:
+				query.answer = hexString(convertVma(findLowestVaddr(elf), args));
+				break;
+			default:
+				break;
 		}
 
+		out << query.text << '\t' << query.answer << '\n';
+	}
+
+	return 0;
+}
+
+int printInfo(ELFIO::elfio &input, Args &args, std::ostream &out)
+{
+	if(args.batch != "")
+		return runBatch(input, args, out);
+
+	if(args.printHighestVaddr) {
+		ELFIO::Elf64_Addr vaddr = convertVma(findHighestVaddr(input), args);
+		out << "0x" << std::hex << vaddr << std::dec << '\n';
+	}
+	if(args.printLowestVaddr) {
+		ELFIO::Elf64_Addr vaddr = convertVma(findLowestVaddr(input), args);
+		out << "0x" << std::hex << vaddr << std::dec << '\n';
+	}
+	if(args.printSymbolValue != "") {
+		ELFIO::Elf64_Addr value;
+		if(findSymbolValue(input, args.printSymbolValue, value)) {
+			out << "0x" << std::hex << value << std::dec << "\n";
+		} else {
+			std::cerr << "No symbol named " << args.printSymbolValue << " found.\n";
+		}
+	}
+	if(args.printEntry) {
+		out << "0x" << std::hex << input.get_entry() << std::dec << "\n";
+	}
+
+	return 0;
+}
+
+} /* namespace */
+
+int objinfoMain(int argc, char **argv, Pipe &pipe)
+{
+	try {
+		Stats stats;
+		Args args = Args::parse(argc, argv);
+		std::ostream &out = pipe.toNextStage ? std::cerr : std::cout;
+		int retcode;
+
+		if(pipe.hasInput(args.input)) {
+			/* The image is left for the next stage, if there is one */
+			stats.enter(PhaseQuery);
+			retcode = printInfo(*pipe.image, args, out);
+		} else {
+			if(args.batch == "-" && args.input == "-") {
+				std::cerr << "error: the batch queries and the ELF file can't both come from stdin\n";
+				return 1;
+			}
+
+			stats.enter(PhaseLoad);
+			auto input = loadElf(args.input);
+			stats.enter(PhaseQuery);
+			retcode = printInfo(input, args, out);
+			if(pipe.toNextStage) {
+				stats.enter(PhaseLayout);
+				pipe.passOn(std::move(input));
+			}
+		}
+
+		if(args.stats)
+			stats.report("objinfo");
+		return retcode;
 	} catch (TCLAP::ArgException &e) {
 		std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
 		return 1;
+	} catch (LoadError &e) {
+		std::cerr << "error: " << e.what() << "\n";
+		return 1;
 	}
-
-	return 0;
 }
 
@@ -5,15 +5,19 @@
 #include <algorithm>
 #include <tclap/CmdLine.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
 
 #include "elfio/elfio.hpp"
 #include "common.hpp"
+#include "tools.hpp"
 
 #define VERSION "0.1"
 
-struct ParseError : public std::runtime_error {
-	ParseError(std::string const &message) : std::runtime_error(message) { }
-};
+namespace {
 
 uint8_t parseNybble(char value) {
 	if(value >= '0' && value <= '9')
@@ -109,6 +113,24 @@ struct Patch {
 		unsigned32 = rhs.unsigned32;
 		bytes = std::move(rhs.bytes);
 	}
+
+	/* A u32 patch is written in the byte order of the file being patched, so
+	 * this must be called once that is known, before data() */
+	void setByteOrder(const ELFIO::endianess_convertor &convertor) {
+		if(kind == Unsigned32) {
+			uint32_t value = convertor(unsigned32);
+			bytes.assign((const uint8_t *)&value, (const uint8_t *)&value + sizeof(value));
+		}
+	}
+
+	/* The bytes to be written at addr */
+	const uint8_t *data() const {
+		return bytes.data();
+	}
+
+	size_t size() const {
+		return kind == Unsigned32 ? 4 : bytes.size();
+	}
 };
 
 std::vector<Patch>constructPatchList(const std::vector<std::string> &patchListArgs) {
@@ -121,10 +143,19 @@ std::vector<Patch>constructPatchList(const std::vector<std::string> &patchListAr
 	return patches;
 }
 
+void setByteOrder(std::vector<Patch> &patchList, ELFIO::elfio &elf)
+{
+	for(auto &patch: patchList)
+		patch.setByteOrder(elf.get_convertor());
+}
+
 struct Args {
 	std::string input;
 	std::string output;
 	std::vector<Patch> patchVaddrs;
+	bool preserveLayout;
+	bool inPlace;
+	bool stats;
 
 	static Args parse(int argc, char **argv){
 		Args args;
@@ -132,6 +163,9 @@ struct Args {
 		TCLAP::CmdLine cmdLine("object file patcher", ' ', VERSION);
 		TCLAP::ValueArg<std::string> outputArg("o", "output", "Output file name", false, "-", "filename", cmdLine);
 		TCLAP::MultiArg<std::string> patchVaddrArg("V", "patch-vaddr", "patch vaddr", false, "addr=patchspec", cmdLine);
+		TCLAP::SwitchArg preserveLayoutArg("p", "preserve-layout", "Copy the input unchanged apart from the patched bytes", cmdLine);
+		TCLAP::SwitchArg inPlaceArg("i", "in-place", "Patch the input file itself", cmdLine);
+		TCLAP::SwitchArg statsArg("", "stats", "Report the time taken by each phase, and the I/O and allocations done, on stderr", cmdLine);
 		TCLAP::UnlabeledValueArg<std::string> inputArg("input", "Input (default stdin)", false, "-", "filename", cmdLine);
 
 		cmdLine.parse(argc, argv);
@@ -139,41 +173,38 @@ struct Args {
 		args.input = inputArg.getValue();
 		args.output = outputArg.getValue();
 		args.patchVaddrs = constructPatchList(patchVaddrArg.getValue());
+		args.preserveLayout = preserveLayoutArg.getValue();
+		args.inPlace = inPlaceArg.getValue();
+		args.stats = statsArg.getValue();
 
 		return args;
 	}
 };
 
-void patchSectionData(ELFIO::section *section, off_t offset, uint8_t *bytes, size_t bytes_length)
+ELFIO::section *findSectionForVaddr(ELFIO::elfio &elf, ELFIO::Elf64_Addr vaddr)
 {
-
-	ELFIO::Elf_Xword section_size = section->get_size();
-	uint8_t *patched = new uint8_t[section_size];
-	const uint8_t *orig = (const uint8_t *)section->get_data();
-
-	memcpy(patched, orig, section_size);
-	memcpy(&patched[offset], bytes, bytes_length);
-
-	section->set_data((const char *)patched, section_size);
-
-	delete[] patched;
+	return elf.sections.find_by_address(vaddr, SHT_PROGBITS);
 }
 
-ELFIO::section *findSectionForVaddr(ELFIO::elfio &elf, ELFIO::Elf64_Addr vaddr)
-{
-	for(auto section : elf.sections) {
-		if(section->get_type() == SHT_PROGBITS
-				&& section->get_address() <= vaddr
-				&& (section->get_address() + section->get_size()) > vaddr) {
-			return section;
-		}
+/* A patch resolved to a position within a section */
+struct SectionPatch {
+	ELFIO::section *section;
+	ELFIO::Elf_Xword offset;
+	const Patch *patch;
+
+	bool operator<(const SectionPatch &rhs) const {
+		if(section->get_index() != rhs.section->get_index())
+			return section->get_index() < rhs.section->get_index();
+		return offset < rhs.offset;
 	}
-	return nullptr;
-}
+};
 
 int patchVaddrs(ELFIO::elfio &elf, std::vector<Patch>&patchList)
 {
+	setByteOrder(patchList, elf);
+
 	/* Elfio insists on us patching data in section rather than segment, so do things that way. */
+	std::vector<SectionPatch> sectionPatches;
 	for(auto &patch: patchList) {
 		ELFIO::section *section = findSectionForVaddr(elf, patch.addr);
 
@@ -182,69 +213,395 @@ int patchVaddrs(ELFIO::elfio &elf, std::vector<Patch>&patchList)
 			return -1;
 		}
 
-		off_t offset = patch.addr - section->get_address();
+		SectionPatch sectionPatch;
+		sectionPatch.section = section;
+		sectionPatch.offset = patch.addr - section->get_address();
+		sectionPatch.patch = &patch;
+		if(sectionPatch.offset + patch.size() > section->get_size()) {
+			std::cerr << "Patch data extends past the end of its section\n";
+			return -1;
+		}
+		sectionPatches.push_back(sectionPatch);
+	}
 
-		switch(patch.kind) {
-			case Patch::RawBytes:
-				patchSectionData(section, offset, patch.bytes.data(), patch.bytes.size());
-				break;
-			case Patch::Unsigned32: {
-				/* TODO: endianness conversion (use endianness specified in ELF
-				 * header and allow fallback to cmdline for multi endian systems) */
-				patchSectionData(section, offset, (uint8_t *)(&patch.unsigned32), 4);
-				break;
-			}
-			default:
-				abort();
-				break;
-		} 
+	/* Sort the patches by section and address, so that any which overlap
+	 * are next to each other */
+	std::stable_sort(sectionPatches.begin(), sectionPatches.end());
+	for(size_t i = 1; i < sectionPatches.size(); i++) {
+		const SectionPatch &prev = sectionPatches[i - 1];
+		if(prev.section == sectionPatches[i].section
+				&& prev.offset + prev.patch->size() > sectionPatches[i].offset) {
+			std::cerr << "Overlapping patches\n";
+			return -1;
+		}
+	}
+
+	for(auto &sectionPatch: sectionPatches) {
+		if(!sectionPatch.section->write_data(sectionPatch.offset, (const char *)sectionPatch.patch->data(), sectionPatch.patch->size())) {
+			std::cerr << "Couldn't modify section " << sectionPatch.section->get_name() << "\n";
+			return -1;
+		}
 	}
 
 	return 0;
 }
 
-ELFIO::elfio loadElf(std::string &input)
+ELFIO::elfio loadElf(std::string &input, std::vector<CompressedSegment> &compressed)
 {
-	/* Pretty nasty -- loading non-seekable streams requires creating a
-	 * temporary copy first, which we only do if the input is stdin */
+	/* stdin may be a pipe, in which case it is drained into memory rather
+	 * than mapped */
 	ELFIO::elfio elf;
 
 	if(input == "-") {
-		elf.load_nonseekable(std::cin);
+		elf.load_fd(STDIN_FILENO);
 	} else {
-		elf.load(input);
+		elf.load_mapped(input);
 	}
 
+	decompressElf(elf, compressed);
+
 	return elf;
 }
 
-int main(int argc, char **argv)
+/* Find where the bytes for [vaddr, vaddr + length) live in the file, using the
+ * program headers. Works whether or not the file has section headers. */
+bool vaddrToFileOffset(ELFIO::elfio &elf, ELFIO::Elf64_Addr vaddr, size_t length, ELFIO::Elf64_Off &offset)
+{
+	ELFIO::segment *segment = elf.segments.find_by_address(vaddr, PT_LOAD);
+	if(segment == nullptr)
+		return false;
+
+	/* Only the part of the segment present in the file can be patched */
+	ELFIO::Elf64_Addr start = segment->get_virtual_address();
+	ELFIO::Elf_Xword fileSize = segment->get_file_size();
+	if(vaddr - start >= fileSize || length > fileSize - (vaddr - start))
+		return false;
+
+	offset = segment->get_offset() + (vaddr - start);
+	return true;
+}
+
+struct FilePatch {
+	ELFIO::Elf64_Off offset;
+	const Patch *patch;
+
+	bool operator<(const FilePatch &rhs) const {
+		return offset < rhs.offset;
+	}
+};
+
+/* Resolve every patch to a file offset, in offset order. The program headers
+ * may claim more than the file holds if it has been truncated, so each patch
+ * must also lie within the fileSize bytes actually there. */
+bool resolveFilePatches(ELFIO::elfio &elf, std::vector<Patch> &patchList, ELFIO::Elf64_Off fileSize, std::vector<FilePatch> &filePatches)
+{
+	setByteOrder(patchList, elf);
+	for(auto &patch: patchList) {
+		FilePatch filePatch;
+		if(!vaddrToFileOffset(elf, patch.addr, patch.size(), filePatch.offset)) {
+			std::cerr << "Couldn't find file data for patch vaddr\n";
+			return false;
+		}
+		if(filePatch.offset > fileSize || patch.size() > fileSize - filePatch.offset) {
+			std::cerr << "Patch data is past the end of the file\n";
+			return false;
+		}
+		filePatch.patch = &patch;
+		filePatches.push_back(filePatch);
+	}
+
+	std::stable_sort(filePatches.begin(), filePatches.end());
+	for(size_t i = 1; i < filePatches.size(); i++) {
+		if(filePatches[i - 1].offset + filePatches[i - 1].patch->size() > filePatches[i].offset) {
+			std::cerr << "Overlapping patches\n";
+			return false;
+		}
+	}
+
+	return true;
+}
+
+/* patchPreservingLayout once the input is open */
+int copyWithPatches(int inFd, const std::string &input, const std::string &output, std::vector<Patch> &patchList, Stats &stats)
+{
+	/* Only the headers are read, unless the input is a pipe. */
+	auto image = ELFIO::file_image::read_fd(inFd, true);
+	ELFIO::elfio elf;
+	if(!image || !elf.load(image)) {
+		std::cerr << "Failed to load " << input << "\n";
+		return -1;
+	}
+
+	std::vector<CompressedSegment> compressed;
+	if(findCompressionNote(elf, compressed)) {
+		std::cerr << "Compressed images can't be patched preserving their layout\n";
+		return -1;
+	}
+
+	struct stat st;
+	bool inputIsFile = fstat(inFd, &st) == 0 && S_ISREG(st.st_mode);
+
+	/* The copy runs to the end of the image, so no patch may go past it */
+	stats.enter(PhasePatch);
+	std::vector<FilePatch> filePatches;
+	if(!resolveFilePatches(elf, patchList, image->get_size(), filePatches))
+		return -1;
+
+	/* Opening the input itself for output would truncate it before it has
+	 * been copied, so in that case the output is written to a temporary file
+	 * next to it, which then replaces it. If the output is a link to the
+	 * input, it is the file linked to that gets replaced. */
+	std::string target = output;
+	if(output != "-") {
+		char *resolved = realpath(output.c_str(), nullptr);
+		if(resolved != nullptr) {
+			target = resolved;
+			free(resolved);
+		}
+	}
+
+	struct stat outSt;
+	bool sameFile = output != "-" && inputIsFile && stat(target.c_str(), &outSt) == 0
+		&& outSt.st_dev == st.st_dev && outSt.st_ino == st.st_ino;
+	std::string writePath = sameFile ? target + ".XXXXXX" : output;
+	int outFd;
+	if(output == "-") {
+		outFd = STDOUT_FILENO;
+	} else if(sameFile) {
+		outFd = mkstemp(&writePath[0]);
+		if(outFd >= 0)
+			fchmod(outFd, st.st_mode & 07777);
+	} else {
+		outFd = open(output.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if(outFd < 0) {
+		std::cerr << "Couldn't open " << writePath << "\n";
+		return -1;
+	}
+
+	/* Each step copies the unmodified bytes up to the next patch (or the end
+	 * of the file) and then writes the patch. */
+	stats.enter(PhaseSave);
+	ELFIO::Elf64_Off position = 0;
+	ELFIO::Elf64_Off end = image->get_size();
+	bool good = true;
+	for(size_t i = 0; good && i <= filePatches.size(); i++) {
+		ELFIO::Elf64_Off next = i < filePatches.size() ? filePatches[i].offset : end;
+
+		if(inputIsFile)
+			good = copyFdRange(inFd, position, outFd, next - position);
+		else
+			good = writeAll(outFd, image->view(position, next - position), next - position);
+
+		if(good && i < filePatches.size()) {
+			const Patch *patch = filePatches[i].patch;
+			good = writeAll(outFd, (const char *)patch->data(), patch->size());
+			next += patch->size();
+		}
+
+		position = next;
+	}
+
+	if(outFd != STDOUT_FILENO)
+		good = close(outFd) == 0 && good;
+	if(sameFile) {
+		good = good && rename(writePath.c_str(), target.c_str()) == 0;
+		if(!good)
+			unlink(writePath.c_str());
+	}
+
+	if(!good) {
+		std::cerr << "Failed to write " << output << "\n";
+		return -1;
+	}
+
+	return 0;
+}
+
+/* Patch without re-laying out the file: the output is the input byte for
+ * byte except for the patched ranges. The unmodified ranges in between are
+ * copied by the kernel where it can. */
+int patchPreservingLayout(const std::string &input, const std::string &output, std::vector<Patch> &patchList, Stats &stats)
+{
+	stats.enter(PhaseLoad);
+	int inFd = input == "-" ? STDIN_FILENO : open(input.c_str(), O_RDONLY);
+	if(inFd < 0) {
+		std::cerr << "Couldn't open " << input << "\n";
+		return -1;
+	}
+
+	int retcode = copyWithPatches(inFd, input, output, patchList, stats);
+	if(inFd != STDIN_FILENO)
+		close(inFd);
+
+	return retcode;
+}
+
+/* Patch a file on disk directly: only the program headers are read, and the
+ * patched bytes are written through one shared mapping of the pages from the
+ * first patch to the last, which is synced once. Nothing else in the file is
+ * touched. */
+int patchInPlace(const std::string &filename, std::vector<Patch> &patchList, Stats &stats)
+{
+	stats.enter(PhaseLoad);
+	ELFIO::elfio elf;
+	if(!elf.load_lazy(filename)) {
+		std::cerr << "Failed to load " << filename << "\n";
+		return -1;
+	}
+
+	std::vector<CompressedSegment> compressed;
+	if(findCompressionNote(elf, compressed)) {
+		std::cerr << "Compressed images can't be patched in place\n";
+		return -1;
+	}
+
+	int fd = open(filename.c_str(), O_RDWR);
+	if(fd < 0) {
+		std::cerr << "Couldn't open " << filename << " for writing\n";
+		return -1;
+	}
+
+	/* Resolve every patch before writing any of them. Writing through the
+	 * mapping past the end of the file would raise SIGBUS. */
+	stats.enter(PhasePatch);
+	struct stat st;
+	std::vector<FilePatch> filePatches;
+	if(fstat(fd, &st) != 0 || !resolveFilePatches(elf, patchList, st.st_size, filePatches)) {
+		close(fd);
+		return -1;
+	}
+
+	int retcode = 0;
+	if(!filePatches.empty()) {
+		off_t pageMask = ~(off_t)(sysconf(_SC_PAGESIZE) - 1);
+		off_t mapStart = filePatches.front().offset & pageMask;
+		size_t mapLength = filePatches.back().offset + filePatches.back().patch->size() - mapStart;
+
+		void *map = mmap(nullptr, mapLength, PROT_READ | PROT_WRITE, MAP_SHARED, fd, mapStart);
+		if(map == MAP_FAILED) {
+			retcode = -1;
+		} else {
+			for(auto &filePatch: filePatches)
+				memcpy((char *)map + (filePatch.offset - mapStart), filePatch.patch->data(), filePatch.patch->size());
+
+			if(msync(map, mapLength, MS_SYNC) != 0)
+				retcode = -1;
+			munmap(map, mapLength);
+		}
+	}
+
+	if(close(fd) != 0)
+		retcode = -1;
+
+	if(retcode != 0)
+		std::cerr << "Failed to write " << filename << "\n";
+
+	return retcode;
+}
+
+int patchElf(ELFIO::elfio &elf, Args &args, Stats &stats)
+{
+	stats.enter(PhasePatch);
+	if(args.patchVaddrs.size() && patchVaddrs(elf, args.patchVaddrs) != 0) {
+		std::cerr << "Patching failed\n";
+		return 1;
+	}
+
+	return 0;
+}
+
+/* A compressed input is patched decompressed, and its segments that were
+ * compressed are compressed again on the way out */
+int saveOrPassOn(ELFIO::elfio &output, const std::vector<CompressedSegment> &compressed, Args &args, Pipe &pipe, Stats &stats)
+{
+	recompressElf(output, compressed);
+
+	if(pipe.toNextStage) {
+		stats.enter(PhaseLayout);
+		pipe.passOn(std::move(output));
+	} else {
+		saveElf(output, args.output, stats);
+	}
+
+	if(args.stats)
+		stats.report("objpatch");
+	return 0;
+}
+
+} /* namespace */
+
+int objpatchMain(int argc, char **argv, Pipe &pipe)
 {
 	try {
+		Stats stats;
 		Args args = Args::parse(argc, argv);
 
-		auto input = loadElf(args.input);
-		auto output = newFromTemplate(input);
-		copyElfData(output, input);
+		if((args.inPlace || args.preserveLayout) && (pipe.image || pipe.toNextStage)) {
+			std::cerr << "error: -i and -p patch files, and can't be used in a pipeline\n";
+			return 1;
+		}
+		if(pipe.toNextStage && args.output != "-") {
+			std::cerr << "error: -o can't be used before another stage\n";
+			return 1;
+		}
 
-		int retcode = 0;
+		if(args.inPlace) {
+			if(args.input == "-" || args.output != "-" || args.preserveLayout) {
+				std::cerr << "error: -i patches a named input file and cannot be combined with -o or -p\n";
+				return 1;
+			}
 
-		if(args.patchVaddrs.size()) {
-			retcode |= patchVaddrs(output, args.patchVaddrs);
+			int retcode = patchInPlace(args.input, args.patchVaddrs, stats);
+			if(retcode != 0)
+				std::cerr << "Patching failed\n";
+			else if(args.stats)
+				stats.report("objpatch");
+			return retcode == 0 ? 0 : 1;
 		}
 
-		if(retcode == 0) {
-			output.save(args.output);
-		} else {
-			std::cerr << "Patching failed\n";
+		if(args.preserveLayout) {
+			int retcode = patchPreservingLayout(args.input, args.output, args.patchVaddrs, stats);
+			if(retcode != 0)
+				std::cerr << "Patching failed\n";
+			else if(args.stats)
+				stats.report("objpatch");
+			return retcode == 0 ? 0 : 1;
+		}
+
+		if(pipe.hasInput(args.input)) {
+			/* The previous stage's image is ours, so patch it where it is */
+			std::vector<CompressedSegment> compressed;
+			auto output = pipe.takeInput(compressed);
+			if(patchElf(output, args, stats) != 0)
+				return 1;
+			return saveOrPassOn(output, compressed, args, pipe, stats);
 		}
 
-		return retcode;
+		stats.enter(PhaseLoad);
+		std::vector<CompressedSegment> compressed;
+		auto input = loadElf(args.input, compressed);
+
+		/* The input is patched before it is copied, while its file image
+		 * is its own: the patched bytes are written into the image then,
+		 * rather than each section they land in being copied first */
+		if(patchElf(input, args, stats) != 0)
+			return 1;
+
+		stats.enter(PhaseCopy);
+		auto output = newFromTemplate(input);
+		copyElfData(output, input);
+
+		return saveOrPassOn(output, compressed, args, pipe, stats);
 	} catch (TCLAP::ArgException &e) {
 		std::cerr << "error: " << e.error() << " for arg " << e.argId() << std::endl;
 		return 1;
+	} catch (LoadError &e) {
+		std::cerr << "error: " << e.what() << "\n";
+		return 1;
+	} catch (ParseError &e) {
+		std::cerr << "error: " << e.what() << "\n";
+		return 1;
 	}
-
-	return 0;
 }
 
@@ -0,0 +1,91 @@
+#include <vector>
+#include <string>
+#include <iostream>
+#include <cstring>
+#include <tclap/CmdLine.h>
+
+#include "common.hpp"
+#include "tools.hpp"
+
+struct Tool {
+	const char *stage;
+	const char *program;
+	int (*main)(int argc, char **argv, Pipe &pipe);
+};
+
+static const Tool tools[] = {
+	{"cat", "objcat", objcatMain},
+	{"patch", "objpatch", objpatchMain},
+	{"info", "objinfo", objinfoMain},
+	{"gen", "objgen", objgenMain},
+};
+
+static const Tool *findTool(const std::string &name)
+{
+	for(auto &tool: tools) {
+		if(name == tool.stage || name == tool.program)
+			return &tool;
+	}
+
+	return nullptr;
+}
+
+static int usage()
+{
+	std::cerr << "usage: saruman STAGE [ARGS...] [+ STAGE [ARGS...]]...\n"
+		"\n"
+		"Stages are cat, patch, info and gen, which take the same arguments as\n"
+		"objcat, objpatch, objinfo and objgen. Each stage reads the previous stage's\n"
+		"output in place of stdin, without it being written out and parsed again.\n"
+		"info prints to stdout as the last stage, and to stderr before another.\n"
+		"\n"
+		"    saruman cat kernel.elf sigma0.elf + patch -V 0x80001000=u32:1 + info -E\n";
+	return 1;
+}
+
+int main(int argc, char **argv)
+{
+	/* Called through a link as one of the tools */
+	const char *slash = strrchr(argv[0], '/');
+	const Tool *invokedAs = findTool(slash == nullptr ? argv[0] : slash + 1);
+	if(invokedAs != nullptr) {
+		Pipe pipe;
+		return invokedAs->main(argc, argv, pipe);
+	}
+
+	/* Otherwise the command line is a pipeline of stages separated by "+" */
+	std::vector<std::vector<char *>> stages(1);
+	for(int i = 1; i < argc; i++) {
+		if(strcmp(argv[i], "+") == 0)
+			stages.push_back(std::vector<char *>());
+		else
+			stages.back().push_back(argv[i]);
+	}
+
+	std::vector<const Tool *> stageTools;
+	for(auto &stage: stages) {
+		const Tool *tool = stage.empty() ? nullptr : findTool(stage[0]);
+		if(tool == nullptr)
+			return usage();
+		stageTools.push_back(tool);
+	}
+
+	Pipe pipe;
+	for(size_t i = 0; i < stages.size(); i++) {
+		/* The tool reports errors under its own name */
+		std::vector<char *> stageArgv(stages[i]);
+		stageArgv[0] = const_cast<char *>(stageTools[i]->program);
+		stageArgv.push_back(nullptr);
+
+		/* TCLAP remembers an optional unlabeled argument from one command
+		 * line to the next, and would reject the next tool's */
+		TCLAP::OptionalUnlabeledTracker::alreadyOptional() = false;
+
+		pipe.toNextStage = i + 1 < stages.size();
+		int retcode = stageTools[i]->main(stageArgv.size() - 1, stageArgv.data(), pipe);
+		if(retcode != 0)
+			return retcode;
+	}
+
+	return 0;
+}
@@ -0,0 +1,73 @@
+#!/bin/sh
+# A section over 4 GiB, on sparse files so the test needs next to no disk or
+# memory. objgen -Z makes the file; objpatch, in its default mode and with -p
+# and -i, patches past the 4 GiB mark, and objcat copies the file. The
+# headers, the patched bytes and the holes must all survive.
+#
+# usage: sparse-large.sh BINDIR
+
+set -e
+
+bin=$1
+dir=$(mktemp -d ./sparse-large.XXXXXX)
+trap 'rm -rf "$dir"' EXIT
+
+fail() {
+	echo "FAIL: $*" >&2
+	exit 1
+}
+
+# The bytes at a file offset, as hex
+bytesAt() {
+	od -An -tx1 -j "$2" -N "$3" "$1" | tr -d ' \n'
+}
+
+# Holes don't count: a few blocks of headers at most
+checkSparse() {
+	allocated=$(( $(stat -c %b "$1") * $(stat -c %B "$1") ))
+	[ "$allocated" -lt 1048576 ] || fail "$1 has $allocated bytes allocated"
+}
+
+# One 5 GiB section at 0x400000. objgen aligns the segment to 64 KiB in the
+# file, so the section starts at offset 0x10000.
+"$bin/objgen" -Z -n 1 -l 1 -z 5G -y 0 -o "$dir/big.elf"
+size=$(stat -c %s "$dir/big.elf")
+[ "$size" -gt 5368709120 ] || fail "big.elf is only $size bytes"
+checkSparse "$dir/big.elf"
+
+# 4 GiB and a bit into the section
+vaddr=0x100401234
+offset=$(( 0x10000 + 0x100001234 ))
+
+"$bin/objpatch" -p -V $vaddr=u32:0x11223344 -o "$dir/preserved.elf" "$dir/big.elf"
+cp --sparse=always "$dir/big.elf" "$dir/inplace.elf"
+"$bin/objpatch" -i -V $vaddr=u32:0x11223344 "$dir/inplace.elf"
+
+# The default mode rebuilds the file, which keeps the same layout here
+"$bin/objpatch" -V $vaddr=u32:0x11223344 -o "$dir/rebuilt.elf" "$dir/big.elf"
+
+for out in preserved inplace rebuilt; do
+	file="$dir/$out.elf"
+	[ "$(stat -c %s "$file")" -eq "$size" ] || fail "$out.elf changed size"
+	[ "$("$bin/objinfo" -'<' "$file")" = 0x400000 ] || fail "$out.elf lowest vaddr"
+	[ "$("$bin/objinfo" -'>' "$file")" = 0x140400000 ] || fail "$out.elf highest vaddr"
+	[ "$(bytesAt "$file" $offset 4)" = 44332211 ] || fail "$out.elf patched bytes"
+	[ "$(bytesAt "$file" $(( offset - 4 )) 4)" = 00000000 ] || fail "$out.elf bytes before the patch"
+	checkSparse "$file"
+done
+
+# objcat of the rebuilt file keeps its one segment at 0x10000 in the file,
+# followed only by the section table, whose names are objcat's own
+"$bin/objcat" "$dir/rebuilt.elf" >"$dir/cat.elf"
+file="$dir/cat.elf"
+segmentEnd=$(( 0x10000 + 0x140000000 ))
+catSize=$(stat -c %s "$file")
+[ "$catSize" -gt "$segmentEnd" ] && [ "$catSize" -lt $(( segmentEnd + 65536 )) ] \
+	|| fail "cat.elf is $catSize bytes"
+[ "$("$bin/objinfo" -'<' "$file")" = 0x400000 ] || fail "cat.elf lowest vaddr"
+[ "$("$bin/objinfo" -'>' "$file")" = 0x140400000 ] || fail "cat.elf highest vaddr"
+[ "$(bytesAt "$file" $offset 4)" = 44332211 ] || fail "cat.elf patched bytes"
+[ "$(bytesAt "$file" $(( offset - 4 )) 4)" = 00000000 ] || fail "cat.elf bytes before the patch"
+checkSparse "$file"
+
+echo "PASS"
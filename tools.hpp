@@ -0,0 +1,30 @@
+#include <memory>
+#include <vector>
+#include "elfio/elfio.hpp"
+
+/* How a tool run by saruman connects to the stages either side of it. Where
+ * the tool would read an ELF file from stdin it takes the previous stage's
+ * image instead, and where it would write one to stdout it passes it on to
+ * the next stage, if there is one. Run on its own, a tool gets an empty
+ * Pipe. stdout is kept for the image while there is a next stage, so anything
+ * else a tool would print there goes to stderr. */
+struct CompressedSegment;
+
+struct Pipe {
+	std::unique_ptr<ELFIO::elfio> image;
+	bool toNextStage;
+
+	Pipe() : toNextStage(false) { }
+
+	bool hasInput(const std::string &input) const;
+	ELFIO::elfio takeInput();
+	ELFIO::elfio takeInput(std::vector<CompressedSegment> &compressed);
+	void passOn(ELFIO::elfio &&elf);
+};
+
+/* The tools' entry points, which are all linked into saruman. Everything
+ * else in each tool is in an anonymous namespace. */
+int objcatMain(int argc, char **argv, Pipe &pipe);
+int objinfoMain(int argc, char **argv, Pipe &pipe);
+int objpatchMain(int argc, char **argv, Pipe &pipe);
+int objgenMain(int argc, char **argv, Pipe &pipe);